@@ -1,10 +1,20 @@
 
 class Arena {
+    struct Chunk;
+
 public:
+    // the allocation state at some point, to roll back to
+    struct Mark {
+        Chunk *chunk;
+        size_t pos;
+        Chunk *large;
+    };
+
     Arena(size_t chunk_size = 65536)
-    : chunk_size(chunk_size), curr(NULL), freelist(NULL) {}
+    : chunk_size(chunk_size), curr(NULL), freelist(NULL), large(NULL) {}
 
     ~Arena() {
+        free_large();
         while (curr) {
             Chunk *next = curr->next;
             free(curr);
@@ -18,6 +28,7 @@ public:
     }
 
     void reset() {
+        free_large();
         while (curr) {
             Chunk *next = curr->next;
             curr->next = freelist;
@@ -31,9 +42,10 @@ public:
         if (!curr) {
             new_chunk();
         }
-        const size_t alignment = sizeof(void *);
-        size += (alignment - (size & (alignment - 1))) & (alignment - 1);
-        assert(size <= chunk_size);
+        size = align(size);
+        if (size > chunk_size) {
+            return alloc_large(size);
+        }
         if (curr->pos + size > chunk_size) {
             new_chunk();
         }
@@ -47,6 +59,65 @@ public:
         return (T *)alloc(sizeof(T));
     }
 
+    // take over all memory owned by other, which is left empty
+    void absorb(Arena &other) {
+        if (other.chunk_size != chunk_size) {
+            // can't be reused as our chunks, so just keep them until reset
+            splice(large, other.curr);
+            splice(large, other.freelist);
+        } else if (curr) {
+            // keep allocating from our current chunk
+            splice(curr->next, other.curr);
+            splice(freelist, other.freelist);
+        } else {
+            curr = other.curr;
+            splice(freelist, other.freelist);
+        }
+        splice(large, other.large);
+        other.curr = NULL;
+        other.freelist = NULL;
+        other.large = NULL;
+    }
+
+    Mark mark() const {
+        Mark m = { curr, curr ? curr->pos : 0, large };
+        return m;
+    }
+
+    // free everything allocated since m was taken (with no reset or absorb in between)
+    void rollback(const Mark &m) {
+        while (large != m.large) {
+            Chunk *next = large->next;
+            free(large);
+            large = next;
+        }
+        while (curr != m.chunk) {
+            Chunk *next = curr->next;
+            curr->next = freelist;
+            curr->pos = 0;
+            freelist = curr;
+            curr = next;
+        }
+        if (curr) {
+            curr->pos = m.pos;
+        }
+    }
+
+    // try to grow the most recent allocation in place
+    bool grow(char *ptr, size_t old_size, size_t new_size) {
+        old_size = align(old_size);
+        new_size = align(new_size);
+        if (!curr || ptr + old_size != curr->data + curr->pos) {
+            return false;
+        }
+        size_t start = curr->pos - old_size;
+        if (start + new_size > chunk_size) {
+            return false;
+        }
+        curr->pos = start + new_size;
+        return true;
+    }
+
 private:
     Arena(const Arena &); // disallow
     Arena &operator=(const Arena &); // disallow
@@ -60,6 +131,40 @@ private:
     const size_t chunk_size;
     Chunk *curr;
     Chunk *freelist;
+    Chunk *large; // allocations bigger than chunk_size, one per chunk
+
+    static size_t align(size_t size) {
+        const size_t alignment = sizeof(void *);
+        return size + ((alignment - (size & (alignment - 1))) & (alignment - 1));
+    }
+
+    char *alloc_large(size_t size) {
+        Chunk *chunk = (Chunk *)malloc(sizeof(Chunk) + size);
+        chunk->pos = size;
+        chunk->next = large;
+        large = chunk;
+        return chunk->data;
+    }
+
+    static void splice(Chunk *&list, Chunk *other) {
+        if (!other) {
+            return;
+        }
+        Chunk *last = other;
+        while (last->next) {
+            last = last->next;
+        }
+        last->next = list;
+        list = other;
+    }
+
+    void free_large() {
+        while (large) {
+            Chunk *next = large->next;
+            free(large);
+            large = next;
+        }
+    }
 
     void new_chunk() {
         Chunk *chunk = freelist;
@@ -73,3 +178,56 @@ private:
         curr = chunk;
     }
 };
+
+
+// builds a string of any length directly in arena memory, growing it as needed
+class StringBuilder {
+public:
+    StringBuilder(Arena *arena, size_t initial_capacity = 32)
+    : arena(arena), len(0), cap(initial_capacity) {
+        data = arena->alloc(cap + 1);
+    }
+
+    void push(char ch) {
+        if (len == cap) {
+            reserve(len + 1);
+        }
+        data[len++] = ch;
+    }
+
+    void append(const char *str, size_t str_len) {
+        if (len + str_len > cap) {
+            reserve(len + str_len);
+        }
+        memcpy(data + len, str, str_len);
+        len += str_len;
+    }
+
+    // NUL-terminates and returns the string, which stays valid as long as the arena
+    char *finish() {
+        data[len] = '\0';
+        return data;
+    }
+
+    size_t length() const { return len; }
+    size_t capacity() const { return cap; }
+
+private:
+    Arena *arena;
+    char *data;
+    size_t len;
+    size_t cap; // not counting the NUL terminator
+
+    void reserve(size_t needed) {
+        size_t new_cap = cap * 2;
+        if (new_cap < needed) {
+            new_cap = needed;
+        }
+        if (!arena->grow(data, cap + 1, new_cap + 1)) {
+            char *new_data = arena->alloc(new_cap + 1);
+            memcpy(new_data, data, len);
+            data = new_data;
+        }
+        cap = new_cap;
+    }
+};
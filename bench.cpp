@@ -0,0 +1,633 @@
+
+// micro-benchmarks, run with: main --bench
+
+#include <time.h>
+
+double bench_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// deterministic pseudo-random numbers, so runs are comparable
+struct BenchRandom {
+    uint64_t state;
+    BenchRandom(uint64_t seed = 0x9e3779b97f4a7c15ULL) : state(seed) {}
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 16);
+    }
+};
+
+// source text made mostly of symbols, e.g. (def-fn foo-bar (x y) (baz x (qux-quux y)))
+char *bench_symbol_corpus(uint32_t target_len, uint32_t &len_out) {
+    static const char *parts[] = {
+        "foo", "bar", "baz", "qux", "quux", "value", "count", "index", "make",
+        "get", "set", "list", "table", "node", "first", "rest", "result", "x", "y"
+    };
+    const uint32_t num_parts = sizeof(parts) / sizeof(parts[0]);
+
+    BenchRandom rng;
+    char *text = (char *)malloc(target_len + 256);
+    uint32_t len = 0;
+    uint32_t depth = 0;
+    while (len < target_len) {
+        uint32_t r = rng.next();
+        if (r % 7 == 0 && depth < 6) {
+            text[len++] = '(';
+            ++depth;
+        } else if (r % 7 == 1 && depth > 0) {
+            text[len++] = ')';
+            --depth;
+        } else {
+            uint32_t n = 1 + (r >> 8) % 3;
+            for (uint32_t i = 0; i < n; ++i) {
+                const char *part = parts[(r >> (12 + i * 5)) % num_parts];
+                size_t part_len = strlen(part);
+                if (i > 0) {
+                    text[len++] = '-';
+                }
+                memcpy(text + len, part, part_len);
+                len += (uint32_t)part_len;
+            }
+        }
+        text[len++] = (r >> 28) == 0 ? '\n' : ' ';
+    }
+    while (depth-- > 0) {
+        text[len++] = ')';
+    }
+    text[len] = '\0';
+    len_out = len;
+    return text;
+}
+
+// the comparison chains the reader used before CHAR_CLASS
+static inline bool bench_is_symcont_chain(char ch) {
+    if ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9')) {
+        return true;
+    }
+    switch (ch) {
+    case '_': case '-': case '=': case '+': case '*': case '/':
+    case '?': case '!': case '&': case '%': case '^': case '~':
+        return true;
+    default:
+        return false;
+    }
+}
+
+void bench_char_class() {
+    uint32_t len;
+    char *text = bench_symbol_corpus(16 * 1024 * 1024, len);
+    const int rounds = 10;
+
+    // count the symbol chars in the corpus, splitting runs like read_symbol does
+    volatile uint32_t sink = 0;
+    double start = bench_seconds();
+    for (int r = 0; r < rounds; ++r) {
+        uint32_t runs = 0;
+        for (uint32_t i = 0; i < len; ) {
+            uint32_t run_start = i;
+            while (i < len && bench_is_symcont_chain(text[i])) {
+                ++i;
+            }
+            runs += i != run_start;
+            i += i == run_start;
+        }
+        sink = sink + runs;
+    }
+    double chain_time = bench_seconds() - start;
+
+    start = bench_seconds();
+    for (int r = 0; r < rounds; ++r) {
+        uint32_t runs = 0;
+        for (uint32_t i = 0; i < len; ) {
+            uint32_t run_start = i;
+            while (i < len && char_is(text[i], CHAR_SYMCONT)) {
+                ++i;
+            }
+            runs += i != run_start;
+            i += i == run_start;
+        }
+        sink = sink + runs;
+    }
+    double table_time = bench_seconds() - start;
+
+    double bytes = (double)len * rounds;
+    printf("char class: comparison chain %.2f ns/byte, table %.2f ns/byte (%.2fx)\n",
+        chain_time * 1e9 / bytes, table_time * 1e9 / bytes, chain_time / table_time);
+
+    // whole reader over the same corpus
+    Arena arena;
+    Module module;
+    Context ctx;
+    ctx.arena = &arena;
+    ctx.module = &module;
+    Reader reader(&ctx);
+    start = bench_seconds();
+    reader.read_file(text, len);
+    double read_time = bench_seconds() - start;
+    printf("reader: %.1f MB/s on %.1f MB of symbol-dense text\n",
+        len / read_time / 1e6, len / 1e6);
+
+    free(text);
+}
+
+// float literals of the forms found in data modules: short decimals, full
+// precision %.16e output, wide exponents and overlong mantissas
+char *bench_float_corpus(uint32_t count, uint32_t &len_out) {
+    BenchRandom rng(42);
+    char *text = (char *)malloc((size_t)count * 64 + 1);
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t r = rng.next();
+        char *p = text + len;
+        switch (r % 4) {
+        case 0:
+            len += sprintf(p, "%u.%02u", rng.next() % 10000, rng.next() % 100);
+            break;
+        case 1: {
+            uint64_t bits = ((uint64_t)rng.next() << 32) | rng.next();
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            if (d != d || d - d != 0) {
+                d = 1.0 / (r | 1);
+            }
+            len += sprintf(p, "%.16e", d < 0 ? -d : d);
+            break;
+        }
+        case 2:
+            len += sprintf(p, "%u.%ue%d", rng.next() % 1000, rng.next(), (int)(rng.next() % 600) - 300);
+            break;
+        default:
+            len += sprintf(p, "%u%u.%u%u", rng.next(), rng.next(), rng.next(), rng.next());
+            break;
+        }
+        text[len++] = '\n';
+    }
+    text[len] = '\0';
+    len_out = len;
+    return text;
+}
+
+void bench_float_parse() {
+    const uint32_t count = 1000000;
+    uint32_t len;
+    char *text = bench_float_corpus(count, len);
+
+    // check bit-exactness against the C library
+    uint32_t mismatches = 0;
+    for (char *p = text; *p; ) {
+        char *end = strchr(p, '\n');
+        DecimalFloat decimal;
+        uint32_t n = parse_decimal_float(p, (uint32_t)(end - p), decimal);
+        f64 d = decimal_to_float<Binary64Format>(decimal, p, n);
+        f32 f = decimal_to_float<Binary32Format>(decimal, p, n);
+        f64 d_ref = strtod(p, NULL);
+        f32 f_ref = strtof(p, NULL);
+        if (n != (uint32_t)(end - p) || memcmp(&d, &d_ref, sizeof(d)) || memcmp(&f, &f_ref, sizeof(f))) {
+            if (mismatches++ < 5) {
+                printf("float mismatch: %.*s\n", (int)(end - p), p);
+            }
+        }
+        p = end + 1;
+    }
+
+    volatile f64 sink = 0;
+    double start = bench_seconds();
+    for (char *p = text; *p; ) {
+        char *end;
+        sink = sink + strtod(p, &end);
+        p = end + 1;
+    }
+    double strtod_time = bench_seconds() - start;
+
+    start = bench_seconds();
+    for (char *p = text; *p; ) {
+        DecimalFloat decimal;
+        uint32_t n = parse_decimal_float(p, (uint32_t)(text + len - p), decimal);
+        sink = sink + decimal_to_float<Binary64Format>(decimal, p, n);
+        p += n + 1;
+    }
+    double parse_time = bench_seconds() - start;
+
+    printf("float parse: %u literals, %u mismatches against strtod/strtof\n", count, mismatches);
+    printf("float parse: strtod %.1f ns/literal, eisel-lemire %.1f ns/literal (%.2fx)\n",
+        strtod_time * 1e9 / count, parse_time * 1e9 / count, strtod_time / parse_time);
+
+    free(text);
+}
+
+// a module of count definitions like (def f12 (x y) (foo (bar-baz x 1) ...))
+char *bench_module_corpus(uint32_t count, uint32_t &len_out) {
+    static const char *parts[] = { "foo", "bar-baz", "qux", "make-node", "x", "y", "1", "2.5" };
+    const uint32_t num_parts = sizeof(parts) / sizeof(parts[0]);
+
+    BenchRandom rng(7);
+    char *text = (char *)malloc((size_t)count * 512 + 1);
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        len += sprintf(text + len, "(def f%u (x y)\n ", i);
+        uint32_t depth = 0;
+        for (uint32_t k = 0; k < 40; ++k) {
+            uint32_t r = rng.next();
+            if (r % 4 == 0 && depth < 5) {
+                len += sprintf(text + len, " (%s", parts[(r >> 8) % 4]);
+                ++depth;
+            } else if (r % 4 == 1 && depth > 0) {
+                text[len++] = ')';
+                --depth;
+            } else {
+                len += sprintf(text + len, " %s", parts[(r >> 8) % num_parts]);
+            }
+        }
+        while (depth-- > 0) {
+            text[len++] = ')';
+        }
+        len += sprintf(text + len, ")\n");
+    }
+    text[len] = '\0';
+    len_out = len;
+    return text;
+}
+
+void bench_form_index() {
+    const uint32_t count = 100000;
+    uint32_t len;
+    char *text = bench_module_corpus(count, len);
+
+    double start = bench_seconds();
+    {
+        Arena arena;
+        Module module;
+        Context ctx;
+        ctx.arena = &arena;
+        ctx.module = &module;
+        Reader reader(&ctx);
+        reader.read_file(text, len);
+    }
+    double read_time = bench_seconds() - start;
+
+    // index everything, then read 1% of the definitions by name
+    start = bench_seconds();
+    double index_time;
+    {
+        Arena arena;
+        Module module;
+        Context ctx;
+        ctx.arena = &arena;
+        ctx.module = &module;
+        FormIndex index(&ctx);
+        index.index_file(text, len);
+        index_time = bench_seconds() - start;
+        char name[32];
+        for (uint32_t i = 0; i < count; i += 100) {
+            sprintf(name, "f%u", i);
+            uint32_t k;
+            if (!index.find(symbol(&ctx, name), k)) {
+                fatal_error("form index lost %s", name);
+            }
+            index.form(k);
+        }
+    }
+    double lazy_time = bench_seconds() - start;
+
+    printf("form index: %u definitions, %.1f MB\n", count, len / 1e6);
+    printf("form index: full read %.1f ms, index %.1f ms, index + read 1%% %.1f ms (%.2fx)\n",
+        read_time * 1e3, index_time * 1e3, lazy_time * 1e3, read_time / lazy_time);
+
+    free(text);
+}
+
+// times put, get of present keys and get of absent keys on a table of slots slots
+// filled with keys, in ns per operation
+template<typename TTable, typename TKey>
+void bench_table(TKey *keys, uint32_t n, TKey *absent, uint32_t slots, double ns_out[3]) {
+    const int rounds = 20;
+    TTable table(slots);
+    double start = bench_seconds();
+    for (uint32_t i = 0; i < n; ++i) {
+        table.put(keys[i], i);
+    }
+    ns_out[0] = (bench_seconds() - start) * 1e9 / n;
+
+    uint32_t value = 0;
+    volatile uint32_t sink = 0;
+    start = bench_seconds();
+    for (int r = 0; r < rounds; ++r) {
+        for (uint32_t i = 0; i < n; ++i) {
+            table.get(keys[i], value);
+            sink = sink + value;
+        }
+    }
+    ns_out[1] = (bench_seconds() - start) * 1e9 / ((double)n * rounds);
+
+    start = bench_seconds();
+    for (int r = 0; r < rounds; ++r) {
+        for (uint32_t i = 0; i < n; ++i) {
+            sink = sink + table.get(absent[i], value);
+        }
+    }
+    ns_out[2] = (bench_seconds() - start) * 1e9 / ((double)n * rounds);
+}
+
+template<typename TKey>
+void bench_table_pair(const char *key_kind, TKey *keys, TKey *absent, uint32_t slots) {
+    static const double loads[] = { 0.5, 0.75, 0.85 };
+    for (uint32_t l = 0; l < sizeof(loads) / sizeof(loads[0]); ++l) {
+        uint32_t n = (uint32_t)(slots * loads[l]) - 1;
+        double robin_hood[3];
+        double split[3];
+        double swiss[3];
+        bench_table< HashTable<TKey, uint32_t> >(keys, n, absent, slots, robin_hood);
+        bench_table< HashTable<TKey, uint32_t, Hash<TKey>, Equal<TKey>, SplitLayout> >(
+            keys, n, absent, slots, split);
+        bench_table< SwissTable<TKey, uint32_t> >(keys, n, absent, slots, swiss);
+        printf("hash table: %s, load %.2f: put %.1f / %.1f / %.1f ns, hit %.1f / %.1f / %.1f ns, "
+            "miss %.1f / %.1f / %.1f ns\n", key_kind, loads[l],
+            robin_hood[0], split[0], swiss[0], robin_hood[1], split[1], swiss[1],
+            robin_hood[2], split[2], swiss[2]);
+    }
+}
+
+// HashTable, HashTable with SplitLayout, and SwissTable
+void bench_hash_tables() {
+    const uint32_t slots = 1 << 18;
+    BenchRandom rng(99);
+
+    // symbol names as in the symbol table, looked up in random order
+    char *names = (char *)malloc((size_t)slots * 2 * 24);
+    StringRef *strings = (StringRef *)malloc(sizeof(StringRef) * slots * 2);
+    char *p = names;
+    for (uint32_t i = 0; i < slots * 2; ++i) {
+        static const char *prefixes[] = { "make-", "get-", "x", "node-", "parse-from-" };
+        int len = sprintf(p, "%s%x", prefixes[rng.next() % 5], i * 2654435761u);
+        strings[i] = StringRef(p, (uint32_t)len);
+        p += len;
+    }
+
+    // object pointers as in a table keyed by conses, 24 bytes apart in an arena
+    char *arena = (char *)malloc((size_t)slots * 2 * 24);
+    Any **pointers = (Any **)malloc(sizeof(Any *) * slots * 2);
+    for (uint32_t i = 0; i < slots * 2; ++i) {
+        pointers[i] = (Any *)(arena + (size_t)i * 24);
+    }
+    for (uint32_t i = slots * 2 - 1; i > 0; --i) {
+        uint32_t k = rng.next() % (i + 1);
+        StringRef s = strings[i]; strings[i] = strings[k]; strings[k] = s;
+        Any *a = pointers[i]; pointers[i] = pointers[k]; pointers[k] = a;
+    }
+
+    bench_table_pair("symbol names", strings, strings + slots, slots);
+    bench_table_pair("pointers", pointers, pointers + slots, slots);
+
+    free(names);
+    free(strings);
+    free(arena);
+    free(pointers);
+}
+
+// longest single put and total time while filling a table from empty, with
+// resizing all at once, incremental resizing, and reserve
+void bench_table_growth() {
+    const uint32_t count = 4 * 1024 * 1024;
+    char *arena = (char *)malloc((size_t)count * 24);
+    static const char *modes[] = { "rehash at once", "incremental", "reserve" };
+    for (int mode = 0; mode < 3; ++mode) {
+        HashTable<Any *, uint32_t> table;
+        if (mode == 1) {
+            table.set_incremental_resize(true);
+        } else if (mode == 2) {
+            table.reserve(count);
+        }
+        double max_put = 0;
+        double start = bench_seconds();
+        for (uint32_t i = 0; i < count; ++i) {
+            double put_start = bench_seconds();
+            table.put((Any *)(arena + (size_t)i * 24), i);
+            double put_time = bench_seconds() - put_start;
+            if (put_time > max_put) {
+                max_put = put_time;
+            }
+        }
+        double total = bench_seconds() - start;
+        printf("hash table growth: %s, %u puts: total %.1f ms, longest put %.3f ms\n",
+            modes[mode], count, total * 1e3, max_put * 1e3);
+        table.print_stats(stdout, modes[mode]);
+    }
+    free(arena);
+}
+
+// building a table of n entries with put and with put_all, and draining it
+void bench_table_bulk() {
+    const uint32_t count = 1024 * 1024;
+    BenchRandom rng(5);
+    char *arena = (char *)malloc((size_t)count * 24);
+    Any **keys = (Any **)malloc(sizeof(Any *) * count);
+    uint32_t *values = (uint32_t *)malloc(sizeof(uint32_t) * count);
+    for (uint32_t i = 0; i < count; ++i) {
+        keys[i] = (Any *)(arena + (size_t)i * 24);
+        values[i] = rng.next();
+    }
+
+    double start = bench_seconds();
+    {
+        HashTable<Any *, uint32_t> table;
+        for (uint32_t i = 0; i < count; ++i) {
+            table.put(keys[i], values[i]);
+        }
+    }
+    double put_time = bench_seconds() - start;
+
+    start = bench_seconds();
+    {
+        HashTable<Any *, uint32_t> table;
+        table.put_all(keys, values, count);
+    }
+    double put_all_time = bench_seconds() - start;
+
+    // removing all entries shrinks the table as it goes
+    HashTable<Any *, uint32_t> table;
+    table.put_all(keys, values, count);
+    start = bench_seconds();
+    for (uint32_t i = 0; i < count; ++i) {
+        table.remove(keys[i]);
+    }
+    double remove_time = bench_seconds() - start;
+    table.print_stats(stdout, "bulk build and remove");
+
+    printf("hash table bulk build: %u entries, put %.1f ms, put_all %.1f ms (%.2fx), remove all %.1f ms\n",
+        count, put_time * 1e3, put_all_time * 1e3, put_time / put_all_time, remove_time * 1e3);
+
+    free(arena);
+    free(keys);
+    free(values);
+}
+
+// fraction of keys at each probe length (0, 1, 2-3, 4-7, 8-15, 16+) when hashes
+// fill a Robin Hood table of slots slots, as in HashTable
+void bench_probe_lengths(const uint32_t *hashes, uint32_t n, uint32_t slots,
+                         double histogram[6], uint32_t &max_out, double &mean_out) {
+    uint32_t *table = (uint32_t *)calloc(slots, sizeof(uint32_t));
+    uint32_t mask = slots - 1;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t hash = hashes[i] ? hashes[i] : 1;
+        uint32_t index = hash & mask;
+        uint32_t probe = 0;
+        while (table[index]) {
+            uint32_t slot_probe = (index - table[index]) & mask;
+            if (probe > slot_probe) {
+                uint32_t t = table[index]; table[index] = hash; hash = t;
+                probe = slot_probe;
+            }
+            index = (index + 1) & mask;
+            ++probe;
+        }
+        table[index] = hash;
+    }
+
+    for (int b = 0; b < 6; ++b) {
+        histogram[b] = 0;
+    }
+    max_out = 0;
+    double total = 0;
+    for (uint32_t index = 0; index < slots; ++index) {
+        if (!table[index]) {
+            continue;
+        }
+        uint32_t probe = (index - table[index]) & mask;
+        int b = 0;
+        while (b < 5 && probe >= (1u << b)) {
+            ++b;
+        }
+        histogram[b] += 100.0 / n;
+        total += probe;
+        if (probe > max_out) {
+            max_out = probe;
+        }
+    }
+    mean_out = total / n;
+    free(table);
+}
+
+template<typename THash, typename TKey>
+void bench_hash_function(const char *key_kind, const char *hash_name, TKey *keys, uint32_t n, uint32_t slots) {
+    const int rounds = 20;
+    uint32_t *hashes = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    double start = bench_seconds();
+    for (int r = 0; r < rounds; ++r) {
+        for (uint32_t i = 0; i < n; ++i) {
+            hashes[i] = THash()(keys[i]);
+        }
+    }
+    double ns = (bench_seconds() - start) * 1e9 / ((double)n * rounds);
+
+    double histogram[6];
+    uint32_t max_probe;
+    double mean_probe;
+    bench_probe_lengths(hashes, n, slots, histogram, max_probe, mean_probe);
+    printf("hash function: %s, %s: %.2f ns/key, probe mean %.2f max %u, "
+        "0: %.1f%% 1: %.1f%% 2-3: %.1f%% 4-7: %.1f%% 8-15: %.1f%% 16+: %.1f%%\n",
+        key_kind, hash_name, ns, mean_probe, max_probe,
+        histogram[0], histogram[1], histogram[2], histogram[3], histogram[4], histogram[5]);
+    free(hashes);
+}
+
+// WyStringHash::hash_all against one call per key
+void bench_wyhash_batch(const StringRef *keys, uint32_t n) {
+    const int rounds = 20;
+    uint32_t *hashes = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    uint32_t *batched = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    WyStringHash hash;
+    double start = bench_seconds();
+    for (int r = 0; r < rounds; ++r) {
+        for (uint32_t i = 0; i < n; ++i) {
+            hashes[i] = hash(keys[i]);
+        }
+    }
+    double single_ns = (bench_seconds() - start) * 1e9 / ((double)n * rounds);
+
+    start = bench_seconds();
+    for (int r = 0; r < rounds; ++r) {
+        hash.hash_all(keys, n, batched);
+    }
+    double batch_ns = (bench_seconds() - start) * 1e9 / ((double)n * rounds);
+
+    if (memcmp(hashes, batched, sizeof(uint32_t) * n) != 0) {
+        fatal_error("batched wyhash hashes differ");
+    }
+    printf("hash function: symbol names, wyhash batched: %.2f ns/key, one at a time %.2f ns/key (%.2fx)\n",
+        batch_ns, single_ns, single_ns / batch_ns);
+    free(hashes);
+    free(batched);
+}
+
+void bench_collect_conses(Any *form, Any **out, uint32_t &n, uint32_t max) {
+    while (n < max && !nilp(form) && consp(form)) {
+        Ptr<Cons> cell(form);
+        out[n++] = form;
+        bench_collect_conses(cell->car, out, n, max);
+        form = cell->cdr;
+    }
+}
+
+// speed and spread of the string and pointer hashes on the symbols and conses of a
+// read module, at a load of 0.85 as HashTable allows
+void bench_hash_functions() {
+    const uint32_t slots = 1 << 17;
+    const uint32_t n = (uint32_t)(slots * 0.85);
+    uint32_t len;
+    char *text = bench_module_corpus(n + 1000, len);
+    Arena arena;
+    Module module;
+    Context ctx;
+    ctx.arena = &arena;
+    ctx.module = &module;
+    Reader reader(&ctx);
+    Any *forms = reader.read_file(text, len);
+
+    StringRef *names = (StringRef *)malloc(sizeof(StringRef) * n);
+    uint32_t num_names = 0;
+    for (SymbolTable::Iterator it(ctx.symbols); it.valid() && num_names < n; it.next()) {
+        names[num_names++] = it.key();
+    }
+    Any **conses = (Any **)malloc(sizeof(Any *) * n);
+    uint32_t num_conses = 0;
+    bench_collect_conses(forms, conses, num_conses, n);
+    if (num_names < n || num_conses < n) {
+        fatal_error("hash function benchmark: corpus too small");
+    }
+
+    // as if from separate 4 GB regions, differing only in the high 32 bits
+    Any **spread = (Any **)malloc(sizeof(Any *) * n);
+    for (uint32_t i = 0; i < n; ++i) {
+        spread[i] = (Any *)(uintptr_t)(((uint64_t)(i + 1) << 32) | 0x1000);
+    }
+
+    bench_hash_function<MurmurStringHash>("symbol names", "murmur3", names, n, slots);
+    bench_hash_function<WyStringHash>("symbol names", "wyhash", names, n, slots);
+    bench_wyhash_batch(names, n);
+    bench_hash_function<Pointer32Hash>("conses", "pointer32", conses, n, slots);
+    bench_hash_function<Pointer64Hash>("conses", "pointer64", conses, n, slots);
+    if (sizeof(void *) > 4) {
+        bench_hash_function<Pointer32Hash>("pointers 4 GB apart", "pointer32", spread, n, slots);
+        bench_hash_function<Pointer64Hash>("pointers 4 GB apart", "pointer64", spread, n, slots);
+    }
+
+    free(text);
+    free(names);
+    free(conses);
+    free(spread);
+}
+
+int run_benchmarks() {
+    bench_char_class();
+    bench_float_parse();
+    bench_form_index();
+    bench_hash_functions();
+    bench_hash_tables();
+    bench_table_growth();
+    bench_table_bulk();
+    return 0;
+}
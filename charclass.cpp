@@ -0,0 +1,51 @@
+
+// character classes used by the reader, one lookup per byte
+
+enum {
+    CHAR_SYMSTART = 1 << 0, // can start a symbol
+    CHAR_SYMCONT = 1 << 1,  // can continue a symbol
+    CHAR_DIGIT = 1 << 2,
+    CHAR_BLANK = 1 << 3,    // whitespace that does not end a line
+    CHAR_SPACE = 1 << 4,    // any whitespace
+    CHAR_DELIM = 1 << 5,    // can follow an atom ('\0' is end of input)
+    CHAR_HEX = 1 << 6       // hexadecimal digit
+};
+
+#define S CHAR_SYMSTART
+#define C CHAR_SYMCONT
+#define D CHAR_DIGIT
+#define B CHAR_BLANK
+#define W CHAR_SPACE
+#define E CHAR_DELIM
+#define H CHAR_HEX
+
+static const uint8_t CHAR_CLASS[256] = {
+    E, 0, 0, 0, 0, 0, 0, 0, 0, B|W|E, W|E, B|W|E, B|W|E, W|E, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    B|W|E, S|C, 0, 0, 0, S|C, S|C, 0, E, E, S|C, S|C, 0, S|C, E, S|C,
+    C|D|H, C|D|H, C|D|H, C|D|H, C|D|H, C|D|H, C|D|H, C|D|H, C|D|H, C|D|H, E, 0, 0, S|C, 0, S|C,
+    0, S|C|H, S|C|H, S|C|H, S|C|H, S|C|H, S|C|H, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C,
+    S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, E, 0, E, S|C, S|C,
+    0, S|C|H, S|C|H, S|C|H, S|C|H, S|C|H, S|C|H, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C,
+    S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, S|C, 0, 0, 0, S|C, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+#undef S
+#undef C
+#undef D
+#undef B
+#undef W
+#undef E
+#undef H
+
+inline bool char_is(char ch, uint8_t flags) {
+    return (CHAR_CLASS[(uint8_t)ch] & flags) != 0;
+}
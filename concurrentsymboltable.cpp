@@ -0,0 +1,178 @@
+
+// A symbol table that several threads can intern symbols in at once, so that a
+// symbol read by one thread is the same Box<Symbol> as one read by another.
+//
+// Buckets are chains of nodes that are never changed once linked in, so lookups
+// take no locks: they only need an acquire load of the bucket array and of the
+// bucket. Inserts lock one of NUM_STRIPES mutexes, picked by the low bits of the
+// hash (so inserts into one bucket always take the same one), check the bucket
+// again and link a new node in at its head. Each stripe has its own Arena for the
+// nodes and symbols it creates.
+//
+// Growing takes all the stripe locks and builds a new bucket array from copies of
+// the nodes, so readers still walking the old array are unaffected. Old arrays and
+// nodes are freed with the table, which costs at most about as much again as the
+// current ones.
+class ConcurrentSymbolTable {
+public:
+    ConcurrentSymbolTable(uint32_t size = 1024) : count(0) {
+        uint32_t buckets = NUM_STRIPES;
+        while (buckets < size) {
+            buckets *= 2;
+        }
+        table = new_table(buckets, NULL);
+        stripes = new Stripe[NUM_STRIPES];
+    }
+
+    ~ConcurrentSymbolTable() {
+        while (table) {
+            Table *prev = table->prev;
+            free(table->heads);
+            free(table);
+            table = prev;
+        }
+        delete[] stripes;
+    }
+
+    // the symbol named name, or NULL. hash is Hash<StringRef> of name
+    Box<Symbol> *find(StringRef name, uint32_t hash) const {
+        return find_in(__atomic_load_n(&table, __ATOMIC_ACQUIRE), name, hash);
+    }
+
+    // the symbol named name, created if no thread has yet
+    Box<Symbol> *intern(StringRef name, uint32_t hash) {
+        Box<Symbol> *sym = find(name, hash);
+        if (sym) {
+            return sym;
+        }
+
+        Stripe &stripe = stripes[hash & (NUM_STRIPES - 1)];
+        pthread_mutex_lock(&stripe.lock);
+        // another thread may have got here first (and the table can't grow meanwhile)
+        sym = find_in(table, name, hash);
+        if (!sym) {
+            char *name_copy = stripe.arena.alloc(name.length + 1);
+            memcpy(name_copy, name.data, name.length);
+            name_copy[name.length] = '\0';
+
+            sym = stripe.arena.alloc< Box<Symbol> >();
+            sym->type = &type_Symbol.value;
+            sym->value = Symbol((int)name.length, name_copy);
+            link(stripe.arena, table, sym, hash);
+        }
+        pthread_mutex_unlock(&stripe.lock);
+
+        if (__atomic_load_n(&count, __ATOMIC_RELAXED) > table_size()) {
+            grow();
+        }
+        return sym;
+    }
+
+    // add an existing symbol, whose name has to outlive the table, unless one of
+    // that name is already there. hash is Hash<StringRef> of its name
+    void add(Box<Symbol> *sym, uint32_t hash) {
+        StringRef name(sym->value.data, (uint32_t)sym->value.length);
+        Stripe &stripe = stripes[hash & (NUM_STRIPES - 1)];
+        pthread_mutex_lock(&stripe.lock);
+        if (!find_in(table, name, hash)) {
+            link(stripe.arena, table, sym, hash);
+        }
+        pthread_mutex_unlock(&stripe.lock);
+    }
+
+    uint32_t size() const {
+        return __atomic_load_n(&count, __ATOMIC_RELAXED);
+    }
+
+private:
+    ConcurrentSymbolTable(const ConcurrentSymbolTable &); // disallow
+    ConcurrentSymbolTable &operator=(const ConcurrentSymbolTable &); // disallow
+
+    static const uint32_t NUM_STRIPES = 32;
+
+    struct Node {
+        uint32_t hash;
+        Box<Symbol> *sym;
+        Node *next;
+    };
+
+    struct Table {
+        uint32_t mask;
+        Node **heads;
+        Table *prev; // the array this one replaced, kept for readers still using it
+    };
+
+    struct Stripe {
+        pthread_mutex_t lock;
+        Arena arena;
+
+        Stripe() : arena(16384) { pthread_mutex_init(&lock, NULL); }
+        ~Stripe() { pthread_mutex_destroy(&lock); }
+    };
+
+    Table *table;
+    Stripe *stripes;
+    uint32_t count;
+
+    static Table *new_table(uint32_t buckets, Table *prev) {
+        Table *t = (Table *)malloc(sizeof(Table));
+        Node **heads = (Node **)calloc(buckets, sizeof(Node *));
+        if (!t || !heads) {
+            fatal_error("out of memory");
+        }
+        t->mask = buckets - 1;
+        t->heads = heads;
+        t->prev = prev;
+        return t;
+    }
+
+    static Box<Symbol> *find_in(const Table *t, StringRef name, uint32_t hash) {
+        Node *node = __atomic_load_n(&t->heads[hash & t->mask], __ATOMIC_ACQUIRE);
+        for (; node; node = node->next) {
+            Symbol &sym = node->sym->value;
+            if (node->hash == hash && (uint32_t)sym.length == name.length &&
+                memcmp(sym.data, name.data, name.length) == 0) {
+                return node->sym;
+            }
+        }
+        return NULL;
+    }
+
+    // the caller holds the lock of the stripe for hash
+    void link(Arena &arena, Table *t, Box<Symbol> *sym, uint32_t hash) {
+        Node **head = &t->heads[hash & t->mask];
+        Node *node = arena.alloc<Node>();
+        node->hash = hash;
+        node->sym = sym;
+        node->next = *head;
+        __atomic_store_n(head, node, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+    }
+
+    uint32_t table_size() const {
+        return __atomic_load_n(&table, __ATOMIC_ACQUIRE)->mask + 1;
+    }
+
+    void grow() {
+        for (uint32_t i = 0; i < NUM_STRIPES; ++i) {
+            pthread_mutex_lock(&stripes[i].lock);
+        }
+        // unless another thread did it already
+        if (count > table->mask + 1) {
+            Table *old = table;
+            Table *t = new_table((old->mask + 1) * 2, old);
+            for (uint32_t i = 0; i <= old->mask; ++i) {
+                for (Node *node = old->heads[i]; node; node = node->next) {
+                    Node *copy = stripes[0].arena.alloc<Node>();
+                    *copy = *node;
+                    copy->next = t->heads[node->hash & t->mask];
+                    t->heads[node->hash & t->mask] = copy;
+                }
+            }
+            __atomic_store_n(&table, t, __ATOMIC_RELEASE);
+        }
+        for (uint32_t i = NUM_STRIPES; i-- > 0; ) {
+            pthread_mutex_unlock(&stripes[i].lock);
+        }
+    }
+};
@@ -0,0 +1,89 @@
+
+// Errors found in source text.
+//
+// Without Diagnostics an error in the source is printed and ends the process. A
+// Context with Diagnostics whose recovery point is set instead records each error
+// here and unwinds to the recovery point with longjmp (exceptions are disabled),
+// which lets the reader drop the bad form and go on with the next one. Code that
+// longjmp may unwind through must not hold anything that needs a destructor.
+class Diagnostics {
+public:
+    struct Entry {
+        bool located;
+        uint32_t offset; // in the module's source text (see LineIndex)
+        char *message;
+    };
+
+    // where errors unwind to, or NULL to make them fatal
+    jmp_buf *recovery;
+
+    Diagnostics() : recovery(NULL), entries(NULL), count(0), capacity(0) {}
+
+    ~Diagnostics() {
+        clear();
+        free(entries);
+    }
+
+    void add(bool located, uint32_t offset, const char *message) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            entries = (Entry *)realloc(entries, sizeof(Entry) * capacity);
+            if (!entries) {
+                fatal_error("out of memory");
+            }
+        }
+        Entry &e = entries[count++];
+        e.located = located;
+        e.offset = offset;
+        e.message = strdup(message);
+    }
+
+    // move all of other's entries to the end of ours
+    void append(Diagnostics &other) {
+        for (uint32_t i = 0; i < other.count; ++i) {
+            Entry &e = other.entries[i];
+            add(e.located, e.offset, e.message);
+            free(e.message);
+        }
+        other.count = 0;
+    }
+
+    uint32_t size() const {
+        return count;
+    }
+
+    const Entry &entry(uint32_t i) const {
+        assert(i < count);
+        return entries[i];
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < count; ++i) {
+            free(entries[i].message);
+        }
+        count = 0;
+    }
+
+    void print(const LineIndex &lines) const {
+        for (uint32_t i = 0; i < count; ++i) {
+            print(lines, entries[i].located, entries[i].offset, entries[i].message);
+        }
+    }
+
+    static void print(const LineIndex &lines, bool located, uint32_t offset, const char *message) {
+        if (located) {
+            SourceLoc loc = lines.lookup(offset);
+            printf("line %d, col %d: %s\n", loc.line + 1, loc.col + 1, message);
+        } else {
+            printf("unknown location: %s\n", message);
+        }
+    }
+
+private:
+    Diagnostics(const Diagnostics &); // disallow
+    Diagnostics &operator=(const Diagnostics &); // disallow
+
+    Entry *entries;
+    uint32_t count;
+    uint32_t capacity;
+};
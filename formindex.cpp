@@ -0,0 +1,223 @@
+
+// Indexes the top-level forms of a source text without reading them, so that only
+// the definitions actually used need to be read.
+//
+// Indexing is a FormScanner pass over the text plus a look at the first two atoms
+// of each form, which are interned as its head and name (def and foo in
+// "(def foo ...)" or "(def (foo T) ...)"), all hashed in one batch at the end. A form is read with a normal Reader the
+// first time form() is called for it, so errors inside a form are only reported
+// then. The text must stay valid as long as the index is used.
+class FormIndex {
+public:
+    struct Entry {
+        uint32_t start; // range of the form in the text
+        uint32_t end;
+        Box<Symbol> *head; // NULL unless the form is a list starting with a symbol
+        Box<Symbol> *name; // NULL unless the second element is (or starts with) a symbol
+        Any *form; // NULL until read
+    };
+
+    FormIndex(Context *ctx)
+    : ctx(ctx), file(NULL), text(NULL), len(0), base(0),
+      entries(NULL), atoms(NULL), count(0), capacity(0) {}
+
+    ~FormIndex() {
+        delete file;
+        free(entries);
+        free(atoms);
+    }
+
+    void index_path(const char *path) {
+        // the mapping has to outlive the index, as forms are read from it later
+        file = new MappedFile(path);
+        index_file(file->data(), file->size());
+    }
+
+    // an index holds one text, so this is called once
+    void index_file(const char *text, uint32_t len) {
+        assert(!this->text);
+        this->text = text;
+        this->len = len;
+        base = ctx->module->lines.size();
+        ctx->module->lines.add(text, len);
+
+        FormScanner scanner;
+        uint32_t start = 0;
+        uint32_t pos = 0;
+        while (scanner.scan(text, pos, len)) {
+            add(start, pos);
+            start = pos;
+        }
+        add(start, len);
+        index_names();
+    }
+
+    uint32_t size() const {
+        return count;
+    }
+
+    const Entry &entry(uint32_t i) const {
+        assert(i < count);
+        return entries[i];
+    }
+
+    // index of the first form named name
+    bool find(Box<Symbol> *name, uint32_t &i) {
+        return names.get(name, i);
+    }
+
+    // what the table of names has been through, if built with HASHTABLE_STATS
+    void print_stats(FILE *out) const {
+        names.print_stats(out, "form names");
+    }
+
+    // the i-th top-level form, read on first use
+    Any *form(uint32_t i) {
+        assert(i < count);
+        Entry &e = entries[i];
+        if (!e.form) {
+            Reader reader(ctx);
+            Any *list = reader.read_file(text + e.start, e.end - e.start, base + e.start);
+            e.form = nilp(list) ? &NIL : car(list);
+        }
+        return e.form;
+    }
+
+    // all forms as a list, as Reader::read_file would return them
+    Any *read_all() {
+        Any *result = &NIL;
+        Box<Cons> *tail = NULL;
+        for (uint32_t i = 0; i < count; ++i) {
+            Box<Cons> *next = located_cons(ctx, form(i), &NIL, base + entries[i].start);
+            if (tail) {
+                tail->value.cdr = next;
+            } else {
+                result = next;
+            }
+            tail = next;
+        }
+        return result;
+    }
+
+private:
+    FormIndex(const FormIndex &); // disallow
+    FormIndex &operator=(const FormIndex &); // disallow
+
+    Context *ctx;
+    MappedFile *file;
+    const char *text;
+    uint32_t len;
+    uint32_t base; // offset of text in the module's source (see LineIndex)
+
+    Entry *entries;
+    StringRef *atoms; // head and name of each entry until index_names, empty if none
+    uint32_t count;
+    uint32_t capacity;
+    HashTable<Any *, uint32_t, Hash<Any *>, Equal<Any *>, SplitLayout> names;
+
+    void add(uint32_t start, uint32_t end) {
+        uint32_t pos = skip_space(start, end);
+        if (pos == end) {
+            return; // only whitespace and comments
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            entries = (Entry *)realloc(entries, sizeof(Entry) * capacity);
+            atoms = (StringRef *)realloc(atoms, sizeof(StringRef) * 2 * capacity);
+            if (!entries || !atoms) {
+                fatal_error("out of memory");
+            }
+        }
+        Entry &e = entries[count];
+        e.start = pos;
+        e.end = end;
+        e.head = NULL;
+        e.name = NULL;
+        e.form = NULL;
+
+        StringRef &head = atoms[2 * count];
+        StringRef &name = atoms[2 * count + 1];
+        head = name = StringRef(text, 0);
+        if (text[pos] == '(') {
+            pos = skip_space(pos + 1, end);
+            if (head_atom(pos, end, head)) {
+                pos = skip_space(pos, end);
+                if (pos < end && text[pos] == '(') {
+                    pos = skip_space(pos + 1, end);
+                }
+                head_atom(pos, end, name);
+            }
+        }
+        ++count;
+    }
+
+    // intern heads and names, and fill names in one go once all forms are known
+    void index_names() {
+        uint32_t *hashes = (uint32_t *)malloc(sizeof(uint32_t) * 2 * count);
+        Hash<StringRef>().hash_all(atoms, 2 * count, hashes);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (atoms[2 * i].length) {
+                entries[i].head = symbol(ctx, atoms[2 * i], hashes[2 * i]);
+            }
+            if (atoms[2 * i + 1].length) {
+                entries[i].name = symbol(ctx, atoms[2 * i + 1], hashes[2 * i + 1]);
+            }
+        }
+        free(hashes);
+        free(atoms);
+        atoms = NULL;
+
+        Any **keys = (Any **)malloc(sizeof(Any *) * count);
+        uint32_t *values = (uint32_t *)malloc(sizeof(uint32_t) * count);
+        uint32_t n = 0;
+        // backwards, so that of several forms with the same name the first one wins
+        for (uint32_t i = count; i-- > 0; ) {
+            if (entries[i].name) {
+                keys[n] = entries[i].name;
+                values[n] = i;
+                ++n;
+            }
+        }
+        names.put_all(keys, values, n);
+        free(keys);
+        free(values);
+    }
+
+    uint32_t skip_space(uint32_t pos, uint32_t end) const {
+        while (pos < end) {
+            char ch = text[pos];
+            if (char_is(ch, CHAR_SPACE)) {
+                ++pos;
+            } else if (ch == ';') {
+                while (pos < end && text[pos] != '\n' && text[pos] != '\r') {
+                    ++pos;
+                }
+            } else {
+                break;
+            }
+        }
+        return pos;
+    }
+
+    // the name of the symbol at pos, if it is read as a plain symbol (not a number,
+    // and without postfix syntax applied to it); pos is moved past it
+    bool head_atom(uint32_t &pos, uint32_t end, StringRef &atom_out) {
+        if (pos >= end || !char_is(text[pos], CHAR_SYMSTART)) {
+            return false;
+        }
+        char ch = text[pos];
+        if ((ch == '+' || ch == '-') && pos + 1 < end && char_is(text[pos + 1], CHAR_DIGIT)) {
+            return false;
+        }
+        uint32_t start = pos;
+        while (pos < end && char_is(text[pos], CHAR_SYMCONT)) {
+            ++pos;
+        }
+        uint32_t after = skip_space(pos, end);
+        if (after < end && (text[after] == '.' || text[after] == '[' || text[after] == ':')) {
+            return false;
+        }
+        atom_out = StringRef(text + start, pos - start);
+        return true;
+    }
+};
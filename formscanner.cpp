@@ -0,0 +1,170 @@
+
+// Finds the boundaries between top-level forms without reading them, by tracking
+// bracket depth, strings and comments. The scan can be fed incrementally, so forms
+// may straddle the ends of the text given to each call.
+//
+// Because of the postfix syntax (foo.bar, foo[..], foo : type), a form is only
+// known to be complete once the start of the next one has been seen, or at the end
+// of the input.
+class FormScanner {
+public:
+    FormScanner() {
+        reset();
+    }
+
+    void reset() {
+        depth = 0;
+        in_string = false;
+        in_escape = false;
+        in_comment = false;
+        have_form = false;
+        pending = false;
+        in_atom = false;
+    }
+
+    // Scans text[pos..len). Returns true when the end of a top-level form is found,
+    // with pos set to just past it (the start of the next form, or of stray closing
+    // brackets which the reader will report). Otherwise returns false with pos == len.
+    bool scan(const char *text, uint32_t &pos, uint32_t len) {
+        for (; pos < len; ++pos) {
+            if (depth > 0 && !in_string && !in_comment) {
+                // inside a form only brackets, strings and comments matter
+                pos = skip_plain(text, pos, len);
+                if (pos == len) {
+                    break;
+                }
+            }
+            char ch = text[pos];
+
+            if (in_comment) {
+                if (ch == '\n' || ch == '\r') {
+                    in_comment = false;
+                }
+                continue;
+            }
+            if (in_string) {
+                if (in_escape) {
+                    in_escape = false;
+                } else if (ch == '\\') {
+                    in_escape = true;
+                } else if (ch == '"') {
+                    in_string = false;
+                }
+                continue;
+            }
+
+            switch (ch) {
+            case ' ':
+            case '\t':
+            case '\f':
+            case '\v':
+            case '\r':
+            case '\n':
+                in_atom = false;
+                continue;
+            case ';':
+                in_comment = true;
+                in_atom = false;
+                continue;
+            }
+
+            if (depth == 0 && have_form && !pending) {
+                bool continues = ch == '.' || ch == '[' || ch == ':' ||
+                    (in_atom && ch != '(' && ch != ')' && ch != ']' && ch != '"' && ch != '\'');
+                if (!continues) {
+                    end_form(); // ch starts the next form
+                    return true;
+                }
+            }
+
+            switch (ch) {
+            case '(':
+            case '[':
+                ++depth;
+                have_form = true;
+                pending = false;
+                in_atom = false;
+                break;
+            case ')':
+            case ']':
+                in_atom = false;
+                if (depth == 0) {
+                    // unbalanced; let the reader report it
+                    end_form();
+                    ++pos;
+                    return true;
+                }
+                --depth;
+                break;
+            case '"':
+                in_string = true;
+                have_form = true;
+                pending = false;
+                in_atom = false;
+                break;
+            case '\'':
+            case ':':
+            case '.':
+                if (depth == 0) {
+                    have_form = true;
+                    pending = true;
+                }
+                in_atom = false;
+                break;
+            default:
+                if (depth == 0) {
+                    have_form = true;
+                    pending = false;
+                    in_atom = true;
+                }
+                break;
+            }
+        }
+        return false;
+    }
+
+private:
+    uint32_t depth;
+    bool in_string;
+    bool in_escape;
+    bool in_comment;
+    bool have_form; // some of a top-level form has been seen
+    bool pending;   // the top-level form needs another form (after ', : or .)
+    bool in_atom;   // last char at top-level was part of an atom
+
+    // index of the first bracket, '"' or ';' at or after i (or len)
+    static uint32_t skip_plain(const char *text, uint32_t i, uint32_t len) {
+#if defined(__SSE2__)
+        const __m128i lparen = _mm_set1_epi8('(');
+        const __m128i rparen = _mm_set1_epi8(')');
+        const __m128i lbracket = _mm_set1_epi8('[');
+        const __m128i rbracket = _mm_set1_epi8(']');
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i semicolon = _mm_set1_epi8(';');
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+            __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, lparen), _mm_cmpeq_epi8(v, rparen)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, lbracket), _mm_cmpeq_epi8(v, rbracket)));
+            m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, semicolon)));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for (; i < len; ++i) {
+            char ch = text[i];
+            if (ch == '(' || ch == ')' || ch == '[' || ch == ']' || ch == '"' || ch == ';') {
+                break;
+            }
+        }
+        return i;
+    }
+
+    void end_form() {
+        have_form = false;
+        pending = false;
+        in_atom = false;
+    }
+};
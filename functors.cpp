@@ -1,4 +1,13 @@
 
+// a string that is not necessarily NUL-terminated
+struct StringRef {
+    const char *data;
+    uint32_t length;
+
+    StringRef() : data(NULL), length(0) {}
+    StringRef(const char *data, uint32_t length) : data(data), length(length) {}
+};
+
 template<typename T>
 struct Equal {
     bool operator()(T a, T b) {
@@ -11,25 +20,67 @@ struct Equal<const char *> {
     bool operator()(const char *a, const char *b) {
         return strcmp(a, b) == 0;
     }
-};
-
-template<typename T>
-struct Hash {
 
+    bool operator()(const char *a, StringRef b) {
+        for (uint32_t i = 0; i < b.length; ++i) {
+            if (!a[i] || a[i] != b.data[i]) {
+                return false;
+            }
+        }
+        return a[b.length] == '\0';
+    }
 };
 
 template<>
-struct Hash<const char *> {
-    uint32_t operator()(const char *key) {
+struct Equal<StringRef> {
+    bool operator()(StringRef a, StringRef b) {
+        return a.length == b.length && memcmp(a.data, b.data, a.length) == 0;
+    }
+};
+
+// Hash functions for strings (NUL-terminated or StringRef, which hash the same)
+// and for pointers. Hash<T> picks one of each; a table can use another by naming
+// it as its THashFunc.
+
+struct MurmurStringHash {
+    uint32_t operator()(const char *key) const {
+        return (*this)(StringRef(key, (uint32_t)strlen(key)));
+    }
+
+    uint32_t operator()(StringRef key) const {
         uint32_t hash;
-        MurmurHash3_x86_32(key, strlen(key), 0, &hash);
+        MurmurHash3_x86_32(key.data, (int)key.length, 0, &hash);
         return hash;
     }
 };
 
-template<typename T>
-struct Hash<T *> {
-    uint32_t operator()(const T *ptr) const {
+struct WyStringHash {
+    uint32_t operator()(const char *key) const {
+        return (*this)(StringRef(key, (uint32_t)strlen(key)));
+    }
+
+    uint32_t operator()(StringRef key) const {
+        return (uint32_t)wyhash(key.data, key.length, 0);
+    }
+
+    // the hashes of n keys, as above, mixing the seed once for all of them and
+    // fetching keys a few ahead of hashing them
+    void hash_all(const StringRef *keys, uint32_t n, uint32_t *out) const {
+        const uint32_t ahead = 8;
+        uint64_t seed = wyhash_seed(0);
+        for (uint32_t i = 0; i < n; ++i) {
+            if (i + ahead < n) {
+                __builtin_prefetch(keys[i + ahead].data);
+            }
+            out[i] = (uint32_t)wyhash_seeded(keys[i].data, keys[i].length, seed);
+        }
+    }
+};
+
+// Thomas Wang's 32-bit integer hash of the low 32 bits of the pointer, so pointers
+// that differ only above those collide
+struct Pointer32Hash {
+    uint32_t operator()(const void *ptr) const {
         uint32_t val = (uint32_t)(intptr_t)ptr;
         val = ~val + (val << 15);
         val = val ^ (val >> 12);
@@ -40,3 +91,25 @@ struct Hash<T *> {
         return val;
     }
 };
+
+// all 64 bits of the pointer mixed by one 64x64->128 bit multiply (wyhash64), so
+// unlike Pointer32Hash it tells apart pointers that differ only in the high bits
+struct Pointer64Hash {
+    uint32_t operator()(const void *ptr) const {
+        return (uint32_t)wyhash64((uint64_t)(uintptr_t)ptr);
+    }
+};
+
+template<typename T>
+struct Hash {
+
+};
+
+template<>
+struct Hash<const char *> : WyStringHash {};
+
+template<>
+struct Hash<StringRef> : WyStringHash {};
+
+template<typename T>
+struct Hash<T *> : Pointer64Hash {};
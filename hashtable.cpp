@@ -3,126 +3,528 @@
 // https://github.com/goossaert/hashmap/blob/master/backshift_hashmap.cc
 // http://codecapsule.com/2013/11/17/robin-hood-hashing-backward-shift-deletion/
 
+// Entries are moved rather than copied where the language allows it.
+#if __cplusplus >= 201103L
+#define HASHTABLE_MOVE(x) std::move(x)
+#else
+#define HASHTABLE_MOVE(x) (x)
+#endif
+
+// Built with HASHTABLE_STATS defined, each HashTable counts what its operations
+// cost, for print_stats to report. Otherwise the counting compiles to nothing.
+#ifdef HASHTABLE_STATS
+#include <time.h>
+#define HASHTABLE_STAT(x) (x)
+
+struct HashTableStats {
+    // one per key looked for, by get and lookup as well as by put, put_all, emplace
+    // and remove
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t hit_dist_total; // dist_to_start of the entries found
+    uint32_t hit_dist_max;
+    uint64_t hit_dist_histogram[6]; // 0, 1, 2-3, 4-7, 8-15, 16+
+    uint64_t displacements; // entries moved along by Robin Hood insertion
+    uint64_t removes;
+    uint64_t shifts; // entries moved back by remove
+    uint32_t resizes;
+    double resize_seconds; // including migration, with incremental resizing
+
+    HashTableStats() {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void hit(uint32_t dist) {
+        ++hits;
+        hit_dist_total += dist;
+        if (dist > hit_dist_max) {
+            hit_dist_max = dist;
+        }
+        int b = 0;
+        while (b < 5 && dist >= (1u << b)) {
+            ++b;
+        }
+        ++hit_dist_histogram[b];
+    }
+
+    static double seconds() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+    void print(FILE *out, const char *name, uint32_t used, uint32_t size) const {
+        uint64_t lookups = hits + misses;
+        fprintf(out, "%s: %u of %u slots used (load %.2f), %u resizes in %.3f ms\n",
+            name, used, size, (double)used / size, resizes, resize_seconds * 1e3);
+        fprintf(out, "%s: %llu lookups, %llu hits, %llu misses, hit distance mean %.2f max %u\n",
+            name, (unsigned long long)lookups, (unsigned long long)hits, (unsigned long long)misses,
+            hits ? (double)hit_dist_total / hits : 0.0, hit_dist_max);
+        fprintf(out, "%s: hit distance 0: %llu, 1: %llu, 2-3: %llu, 4-7: %llu, 8-15: %llu, 16+: %llu\n",
+            name, (unsigned long long)hit_dist_histogram[0], (unsigned long long)hit_dist_histogram[1],
+            (unsigned long long)hit_dist_histogram[2], (unsigned long long)hit_dist_histogram[3],
+            (unsigned long long)hit_dist_histogram[4], (unsigned long long)hit_dist_histogram[5]);
+        fprintf(out, "%s: %llu displacements on insert, %llu removes with %llu shifts\n",
+            name, (unsigned long long)displacements, (unsigned long long)removes,
+            (unsigned long long)shifts);
+    }
+};
+#else
+#define HASHTABLE_STAT(x) ((void)0)
+#endif
+
+// Layouts for the slots of a HashTable. A slot whose hash is 0 is empty, and only
+// the keys and values of other slots are constructed objects.
+
+// hash, key and value of each slot side by side, so a hit touches one place
+template<typename TKey, typename TValue>
+class InterleavedLayout {
+    struct Slot {
+        uint32_t hash;
+        TKey key;
+        TValue value;
+    };
+    Slot *slots;
+
+public:
+    InterleavedLayout() : slots(NULL) {}
+
+    void allocate(uint32_t size) { slots = (Slot *)calloc(size, sizeof(Slot)); }
+    void release() { free(slots); slots = NULL; }
+
+    uint32_t &hash(uint32_t i) const { return slots[i].hash; }
+    TKey &key(uint32_t i) const { return slots[i].key; }
+    TValue &value(uint32_t i) const { return slots[i].value; }
+};
+
+// hashes, keys and values in separate arrays, so probing walks a dense array of
+// hashes and only reads a key when its hash matches
+template<typename TKey, typename TValue>
+class SplitLayout {
+    uint32_t *hashes;
+    TKey *keys;
+    TValue *values;
+
+public:
+    SplitLayout() : hashes(NULL), keys(NULL), values(NULL) {}
+
+    void allocate(uint32_t size) {
+        hashes = (uint32_t *)calloc(size, sizeof(uint32_t));
+        keys = (TKey *)malloc(sizeof(TKey) * size);
+        values = (TValue *)malloc(sizeof(TValue) * size);
+    }
+    void release() {
+        free(hashes);
+        free(keys);
+        free(values);
+        hashes = NULL;
+        keys = NULL;
+        values = NULL;
+    }
+
+    uint32_t &hash(uint32_t i) const { return hashes[i]; }
+    TKey &key(uint32_t i) const { return keys[i]; }
+    TValue &value(uint32_t i) const { return values[i]; }
+};
+
+// A Robin Hood hash table. Keys and values need not be trivial: they are
+// constructed in place in their slots, moved (in C++11) or copied when entries are
+// displaced or rehashed, and destroyed when removed. A pointer or reference to a
+// value in the table stays valid until the next put, put_all, emplace or remove
+// (lookups never move entries, even during an incremental resize).
 template<
     typename TKey,
     typename TValue,
     typename THashFunc = Hash<TKey>,
-    typename TEqualFunc = Equal<TKey>
+    typename TEqualFunc = Equal<TKey>,
+    template<typename, typename> class TLayout = InterleavedLayout
 >
 class HashTable {
+    // an entry on its way into the table
     struct Entry {
         uint32_t hash;
         TKey key;
         TValue value;
 
-        Entry(uint32_t hash, TKey key, TValue value)
+        Entry(uint32_t hash, const TKey &key, const TValue &value)
         : hash(hash), key(key), value(value) {}
+#if __cplusplus >= 201103L
+        Entry(uint32_t hash, TKey &&key, TValue &&value)
+        : hash(hash), key(std::move(key)), value(std::move(value)) {}
+#endif
     };
 
     uint32_t used;
     uint32_t size;
-    Entry *entries;
+    uint32_t min_size; // the table does not shrink below this
+    TLayout<TKey, TValue> slots;
+
+    // With incremental resizing, growing the table keeps the old slots around and
+    // moves MIGRATE_STEP of them to the new ones on each put and emplace (lookups
+    // leave entries where they are, so as not to invalidate pointers to values).
+    // Until that is done, each key is either in slots or in old_slots at or after
+    // migrate_pos. remove and put_all work on both without finishing the migration,
+    // except that a remove in the cluster wrapping around the end of old_slots
+    // migrates that cluster, and put_all finishes it when it has to resize anyway.
+    // The table doesn't shrink until the migration is done.
+    static const uint32_t MIGRATE_STEP = 16;
+    bool incremental;
+    uint32_t old_size; // 0 unless a resize is in progress
+    uint32_t old_used; // entries left in old_slots
+    uint32_t migrate_pos;
+    TLayout<TKey, TValue> old_slots;
+
+#ifdef HASHTABLE_STATS
+    HashTableStats stats;
+#endif
 
     HashTable(const HashTable &); // disallow
     HashTable &operator=(const HashTable &); // disallow
 
 public:
-    HashTable(uint32_t size = 16) {
-        used = 0;
-        resize(next_pow2(size));
+    // visits the occupied slots in table order
+    class Iterator {
+    public:
+        Iterator(const HashTable &table) : table(table), index(0) {
+            skip_empty();
+        }
+
+        bool valid() const { return index < table.size + table.old_size; }
+        void next() { ++index; skip_empty(); }
+        // the hash the entry is stored under, which put_hashed accepts
+        uint32_t hash() const {
+            return index < table.size ? table.slots.hash(index) : table.old_slots.hash(index - table.size);
+        }
+        const TKey &key() const {
+            return index < table.size ? table.slots.key(index) : table.old_slots.key(index - table.size);
+        }
+        TValue &value() const {
+            return index < table.size ? table.slots.value(index) : table.old_slots.value(index - table.size);
+        }
+
+    private:
+        const HashTable &table;
+        uint32_t index; // in slots, then in old_slots (offset by size)
+
+        void skip_empty() {
+            while (valid() && !occupied()) {
+                ++index;
+            }
+        }
+
+        bool occupied() const {
+            if (index < table.size) {
+                return table.slots.hash(index) != 0;
+            }
+            uint32_t old_index = index - table.size;
+            return old_index >= table.migrate_pos && table.old_slots.hash(old_index) != 0;
+        }
+    };
+    friend class Iterator;
+
+    HashTable(uint32_t size = 16)
+    : used(0), size(0), min_size(next_pow2(size)), incremental(false),
+      old_size(0), old_used(0), migrate_pos(0) {
+        resize(min_size);
     }
 
     ~HashTable() {
-        free(entries);
+        destroy_all(slots, size, 0);
+        slots.release();
+        destroy_all(old_slots, old_size, migrate_pos);
+        old_slots.release();
     }
 
-    bool get(TKey key, TValue &value_out) {
-        uint32_t index;
-        if (find(key, index)) {
-            value_out = entries[index].value;
-            return true;
+    // spread the work of growing the table over later calls, rather than
+    // rehashing everything at once (at the cost of both tables being live meanwhile)
+    void set_incremental_resize(bool on) {
+        incremental = on;
+    }
+
+    // make room for n entries, so that putting them does not resize the table (and
+    // removing entries does not shrink it below that)
+    void reserve(uint32_t n) {
+        uint32_t needed = size_for(n);
+        if (needed > min_size) {
+            min_size = needed;
         }
-        return false;
+        if (needed > size) {
+            resize(needed);
+        }
+    }
+
+    // Puts n entries at once. The table is resized at most once, and the entries are
+    // put in order of their home slot, so that they rarely have to displace each
+    // other. If a key occurs more than once, the last value wins as with put.
+    void put_all(const TKey *keys, const TValue *values, uint32_t n) {
+        put_all_with(keys, values, n, NULL);
+    }
+
+    // put_all with the hashes of the keys, as THashFunc computes them, such as
+    // WyStringHash::hash_all gives for many keys at once
+    void put_all_hashed(const uint32_t *key_hashes, const TKey *keys, const TValue *values, uint32_t n) {
+        put_all_with(keys, values, n, key_hashes);
+    }
+
+    // number of entries
+    uint32_t count() const {
+        return used + old_used;
+    }
+
+    bool get(const TKey &key, TValue &value_out) {
+        return get_hashed(THashFunc()(key), key, value_out);
+    }
+
+    // the value for key in the table, or NULL
+    TValue *lookup(const TKey &key) {
+        return lookup_hashed(THashFunc()(key), key);
     }
 
     void put(TKey key, TValue value) {
-        if ((float)used / size > 0.85f) {
-            resize(size * 2);
+        uint32_t hash = THashFunc()(key);
+        put_hashed(hash, HASHTABLE_MOVE(key), HASHTABLE_MOVE(value));
+    }
+
+    // Variants taking the hash of the key, as THashFunc computes it, so that a caller
+    // can hash a key once for several calls. The key looked up may be of any type
+    // TProbe that THashFunc and TEqualFunc accept alongside TKey, such as a StringRef
+    // for const char * keys, which saves building a TKey just to look it up.
+    template<typename TProbe>
+    bool get_hashed(uint32_t hash, const TProbe &key, TValue &value_out) {
+        TValue *value = lookup_hashed(hash, key);
+        if (value) {
+            value_out = *value;
+            return true;
         }
-        put(Entry(calc_hash(key), key, value));
+        return false;
     }
 
-    bool remove(TKey key) {
+    template<typename TProbe>
+    TValue *lookup_hashed(uint32_t hash, const TProbe &key) {
+        hash = fix_hash(hash);
         uint32_t index;
-        if (!find(key, index)) {
-            return false;
+        if (find(slots, size, used, hash, key, index)) {
+            HASHTABLE_STAT(stats.hit(dist_to_start(hash, index, size)));
+            return &slots.value(index);
         }
+        if (find_old(hash, key, index)) {
+            HASHTABLE_STAT(stats.hit(dist_to_start(hash, index, old_size)));
+            return &old_slots.value(index);
+        }
+        HASHTABLE_STAT(++stats.misses);
+        return NULL;
+    }
 
-        for (uint32_t i = 0; i < size; ++i) {
-            uint32_t curr_index = (index + i) & (size - 1);
-            uint32_t next_index = (index + i + 1) & (size - 1);
+    // what the table has been through, if built with HASHTABLE_STATS
+    void print_stats(FILE *out, const char *name) const {
+#ifdef HASHTABLE_STATS
+        stats.print(out, name, used + old_used, size);
+#else
+        (void)out;
+        (void)name;
+#endif
+    }
 
-            uint32_t next_hash = entries[next_index].hash;
-            if (next_hash == 0 || dist_to_start(next_hash, next_index) == 0) {
-                entries[curr_index].hash = 0;
-                --used; // TODO: shrink
-                return true;
-            }
+    void put_hashed(uint32_t hash, TKey key, TValue value) {
+        prepare_put();
+        hash = fix_hash(hash);
+        uint32_t index;
+        if (find_old(hash, key, index)) {
+            count_lookup(true, hash, index, old_size);
+            old_slots.value(index) = HASHTABLE_MOVE(value);
+            return;
+        }
+        put_new_or_assign(hash, key, value);
+    }
 
-            swap(entries[curr_index], entries[next_index]);
+#if __cplusplus >= 201103L
+    // the value for key, constructed in place from args if key is not in the table
+    template<typename... TArgs>
+    TValue &emplace(const TKey &key, TArgs &&...args) {
+        prepare_put();
+        uint32_t hash = calc_hash(key);
+        uint32_t index;
+        if (find_old(hash, key, index)) {
+            count_lookup(true, hash, index, old_size);
+            return old_slots.value(index);
+        }
+        bool existed;
+        index = claim_slot(hash, key, existed);
+        count_lookup(existed, hash, index, size);
+        if (!existed) {
+            new (&slots.key(index)) TKey(key);
+            new (&slots.value(index)) TValue(std::forward<TArgs>(args)...);
         }
+        return slots.value(index);
+    }
+#else
+    // the value for key, default-constructed in place if key is not in the table
+    TValue &emplace(const TKey &key) {
+        prepare_put();
+        uint32_t hash = calc_hash(key);
+        uint32_t index;
+        if (find_old(hash, key, index)) {
+            count_lookup(true, hash, index, old_size);
+            return old_slots.value(index);
+        }
+        bool existed;
+        index = claim_slot(hash, key, existed);
+        count_lookup(existed, hash, index, size);
+        if (!existed) {
+            new (&slots.key(index)) TKey(key);
+            new (&slots.value(index)) TValue();
+        }
+        return slots.value(index);
+    }
+#endif
 
-        assert(0 && "control flow should not get here");
+    bool remove(const TKey &key) {
+        uint32_t hash = calc_hash(key);
+        uint32_t index;
+        if (find(slots, size, used, hash, key, index)) {
+            count_lookup(true, hash, index, size);
+            HASHTABLE_STAT(++stats.removes);
+            remove_at(slots, size, index);
+            --used;
+            shrink_if_sparse();
+            return true;
+        }
+        if (find_old(hash, key, index)) {
+            count_lookup(true, hash, index, old_size);
+            HASHTABLE_STAT(++stats.removes);
+            remove_old_at(index);
+            --old_used;
+            return true;
+        }
+        count_lookup(false, hash, 0, size);
         return false;
     }
 
 private:
-    void put(Entry entry) {
-        uint32_t start_index = entry.hash & (size - 1);
+    void prepare_put() {
+        migrate_some();
+        if ((float)(used + old_used) / size > 0.85f) {
+            grow();
+        }
+    }
+
+    void put_new_or_assign(uint32_t hash, TKey &key, TValue &value) {
+        bool existed;
+        uint32_t index = claim_slot(hash, key, existed);
+        count_lookup(existed, hash, index, size);
+        if (existed) {
+            slots.value(index) = HASHTABLE_MOVE(value);
+        } else {
+            new (&slots.key(index)) TKey(HASHTABLE_MOVE(key));
+            new (&slots.value(index)) TValue(HASHTABLE_MOVE(value));
+        }
+    }
+
+    void put_new_or_assign(uint32_t hash, const TKey &key, const TValue &value) {
+        bool existed;
+        uint32_t index = claim_slot(hash, key, existed);
+        count_lookup(existed, hash, index, size);
+        if (existed) {
+            slots.value(index) = value;
+        } else {
+            new (&slots.key(index)) TKey(key);
+            new (&slots.value(index)) TValue(value);
+        }
+    }
+
+    // counts a lookup made by put, put_all, emplace or remove in stats
+    void count_lookup(bool found, uint32_t hash, uint32_t index, uint32_t in_size) {
+        HASHTABLE_STAT(found ? stats.hit(dist_to_start(hash, index, in_size)) : (void)++stats.misses);
+    }
+
+    // Returns the slot for key: the one holding it (setting existed), or else a
+    // slot taken for it, whose key and value the caller has to construct. Robin
+    // Hood insertion may move the entry that was there further along.
+    uint32_t claim_slot(uint32_t hash, const TKey &key, bool &existed) {
+        uint32_t start_index = hash & (size - 1);
         uint32_t probe = 0;
 
         for (uint32_t i = 0; i < size; ++i, ++probe) {
             uint32_t index = (start_index + i) & (size - 1);
-            Entry &slot = entries[index];
+            uint32_t slot_hash = slots.hash(index);
 
-            if (slot.hash == 0) {
+            if (slot_hash == 0) {
                 ++used;
-                slot = entry;
-                return;
+                slots.hash(index) = hash;
+                existed = false;
+                return index;
             }
 
-            if (slot.hash == entry.hash && TEqualFunc()(slot.key, entry.key)) {
-                slot.value = entry.value;
+            if (slot_hash == hash && TEqualFunc()(slots.key(index), key)) {
+                existed = true;
+                return index;
+            }
+
+            uint32_t slot_probe = dist_to_start(slot_hash, index, size);
+            if (probe > slot_probe) {
+                HASHTABLE_STAT(++stats.displacements);
+                Entry displaced(slot_hash, HASHTABLE_MOVE(slots.key(index)), HASHTABLE_MOVE(slots.value(index)));
+                destroy(slots, index);
+                displace(displaced, index, slot_probe);
+                slots.hash(index) = hash;
+                existed = false;
+                return index;
+            }
+        }
+
+        assert(0 && "control flow should not get here");
+        return 0;
+    }
+
+    // put entry, which was moved out of the slot at index (probe slots from its
+    // home), further along
+    void displace(Entry &entry, uint32_t index, uint32_t probe) {
+        while (true) {
+            index = (index + 1) & (size - 1);
+            ++probe;
+            uint32_t slot_hash = slots.hash(index);
+
+            if (slot_hash == 0) {
+                ++used;
+                slots.hash(index) = entry.hash;
+                new (&slots.key(index)) TKey(HASHTABLE_MOVE(entry.key));
+                new (&slots.value(index)) TValue(HASHTABLE_MOVE(entry.value));
                 return;
             }
 
-            uint32_t slot_probe = dist_to_start(slot.hash, index);
+            uint32_t slot_probe = dist_to_start(slot_hash, index, size);
             if (probe > slot_probe) {
+                HASHTABLE_STAT(++stats.displacements);
                 probe = slot_probe;
-                swap(slot, entry);
+                swap(slots.hash(index), entry.hash);
+                swap(slots.key(index), entry.key);
+                swap(slots.value(index), entry.value);
             }
         }
     }
 
-    bool find(TKey key, uint32_t &index_out) const {
-        if (used == 0) {
+    // slots before live_from are only used to follow probes (see find_old)
+    template<typename TProbe>
+    bool find(const TLayout<TKey, TValue> &in, uint32_t in_size, uint32_t in_used,
+              uint32_t hash, const TProbe &key, uint32_t &index_out,
+              uint32_t live_from = 0) const {
+        if (in_used == 0) {
             return false;
         }
-        uint32_t hash = calc_hash(key);
-        uint32_t start_index = hash & (size - 1);
+        uint32_t start_index = hash & (in_size - 1);
         uint32_t probe = 0;
 
-        for (uint32_t i = 0; i < size; ++i, ++probe) {
-            uint32_t index = (start_index + i) & (size - 1);
-            Entry &slot = entries[index];
+        for (uint32_t i = 0; i < in_size; ++i, ++probe) {
+            uint32_t index = (start_index + i) & (in_size - 1);
+            uint32_t slot_hash = in.hash(index);
 
-            if (slot.hash == hash && TEqualFunc()(slot.key, key)) {
+            if (slot_hash == hash && index >= live_from && TEqualFunc()(in.key(index), key)) {
                 index_out = index;
                 return true;
             }
 
-            if (slot.hash != 0) {
-                probe = dist_to_start(slot.hash, index);
+            if (slot_hash != 0) {
+                probe = dist_to_start(slot_hash, index, in_size);
             }
 
             if (i > probe) {
@@ -132,40 +534,248 @@ private:
         return false;
     }
 
+    // Finds key among the entries not yet migrated. The hashes of old_slots are
+    // left as they were when the resize started, so it can still be probed, but
+    // the keys before migrate_pos have been moved out and must not be compared.
+    template<typename TProbe>
+    bool find_old(uint32_t hash, const TProbe &key, uint32_t &index_out) const {
+        return old_size && find(old_slots, old_size, old_used, hash, key, index_out, migrate_pos);
+    }
+
+    // destroys the entry at index and shifts the entries after it back to fill the gap
+    void remove_at(TLayout<TKey, TValue> &in, uint32_t in_size, uint32_t index) {
+        for (uint32_t i = 0; i < in_size; ++i) {
+            uint32_t curr_index = (index + i) & (in_size - 1);
+            uint32_t next_index = (index + i + 1) & (in_size - 1);
+
+            if (!continues_cluster(in, in_size, next_index)) {
+                destroy(in, curr_index);
+                in.hash(curr_index) = 0;
+                return;
+            }
+
+            // shift the next entry back into the gap
+            HASHTABLE_STAT(++stats.shifts);
+            in.hash(curr_index) = in.hash(next_index);
+            in.key(curr_index) = HASHTABLE_MOVE(in.key(next_index));
+            in.value(curr_index) = HASHTABLE_MOVE(in.value(next_index));
+        }
+        assert(0 && "control flow should not get here");
+    }
+
+    // remove_at for old_slots, whose entries before migrate_pos have been moved out.
+    // Shifting only reaches those when the cluster at index runs off the end of
+    // old_slots and on at its start. Then the live entries further along it are
+    // migrated first, so only the ones up to the end of old_slots need shifting.
+    void remove_old_at(uint32_t index) {
+        uint32_t end = index + 1;
+        while (end < old_size && continues_cluster(old_slots, old_size, end)) {
+            ++end;
+        }
+        if (end < old_size || migrate_pos == 0 || !continues_cluster(old_slots, old_size, 0)) {
+            remove_at(old_slots, old_size, index);
+            return;
+        }
+
+        end = 1;
+        while (continues_cluster(old_slots, old_size, end)) {
+            ++end;
+        }
+        if (end > migrate_pos) {
+            migrate(end - migrate_pos);
+        }
+        for (uint32_t i = index; i + 1 < old_size; ++i) {
+            HASHTABLE_STAT(++stats.shifts);
+            old_slots.hash(i) = old_slots.hash(i + 1);
+            old_slots.key(i) = HASHTABLE_MOVE(old_slots.key(i + 1));
+            old_slots.value(i) = HASHTABLE_MOVE(old_slots.value(i + 1));
+        }
+        destroy(old_slots, old_size - 1);
+        old_slots.hash(old_size - 1) = 0;
+    }
+
+    // true if the entry at index is not in its home slot, so that probes for it
+    // pass the slot before
+    bool continues_cluster(const TLayout<TKey, TValue> &in, uint32_t in_size, uint32_t index) const {
+        uint32_t hash = in.hash(index);
+        return hash != 0 && dist_to_start(hash, index, in_size) != 0;
+    }
+
+    // Halves the table once it is less than a fifth full. It is then 40% full, far
+    // enough from both thresholds that alternating puts and removes don't keep
+    // resizing it. Waits while a resize is being migrated, when the new slots are
+    // bound to look sparse.
+    void shrink_if_sparse() {
+        if (!old_size && size > min_size && (float)used / size < 0.2f) {
+            resize(size / 2);
+        }
+    }
+
+    void grow() {
+        if (!incremental) {
+            resize(size * 2);
+            return;
+        }
+        finish_migration();
+        HASHTABLE_STAT(++stats.resizes);
+        old_slots = slots;
+        old_size = size;
+        old_used = used;
+        migrate_pos = 0;
+
+        used = 0;
+        size *= 2;
+        slots.allocate(size);
+    }
+
+    void migrate_some() {
+        if (old_size) {
+            migrate(MIGRATE_STEP);
+        }
+    }
+
+    void finish_migration() {
+        if (old_size) {
+            migrate(old_size);
+        }
+    }
+
+    void migrate(uint32_t count) {
+#ifdef HASHTABLE_STATS
+        double start = HashTableStats::seconds();
+#endif
+        uint32_t end = old_size - migrate_pos > count ? migrate_pos + count : old_size;
+        for (; migrate_pos < end; ++migrate_pos) {
+            if (old_slots.hash(migrate_pos)) {
+                move_entry(old_slots, migrate_pos);
+                --old_used;
+            }
+        }
+        if (migrate_pos == old_size) {
+            old_slots.release();
+            old_size = 0;
+            old_used = 0;
+        }
+#ifdef HASHTABLE_STATS
+        stats.resize_seconds += HashTableStats::seconds() - start;
+#endif
+    }
+
     void resize(uint32_t new_size) {
-        uint32_t old_used = used;
-        uint32_t old_size = size;
-        Entry *old_entries = entries;
+        finish_migration();
+#ifdef HASHTABLE_STATS
+        double start = HashTableStats::seconds();
+        if (size) {
+            ++stats.resizes; // not the initial allocation
+        }
+#endif
+
+        uint32_t prev_used = used;
+        uint32_t prev_size = size;
+        TLayout<TKey, TValue> prev_slots = slots;
 
         used = 0;
         size = new_size;
-        entries = (Entry *)calloc(1, sizeof(Entry) * new_size);
+        slots.allocate(new_size);
 
-        if (old_used) {
-            assert(old_used <= new_size);
+        if (prev_used) {
+            assert(prev_used <= new_size);
 
-            for (uint32_t i = 0; i < old_size; ++i) {
-                Entry &slot = old_entries[i];
-                if (slot.hash) {
-                    put(slot);
+            for (uint32_t i = 0; i < prev_size; ++i) {
+                if (prev_slots.hash(i)) {
+                    move_entry(prev_slots, i);
                 }
             }
+        }
+        prev_slots.release();
+#ifdef HASHTABLE_STATS
+        stats.resize_seconds += HashTableStats::seconds() - start;
+#endif
+    }
+
+    // move the entry at index in from (a table being emptied, whose keys are not in
+    // slots) to slots, leaving only the hash in from
+    void move_entry(TLayout<TKey, TValue> &from, uint32_t index) {
+        bool existed;
+        uint32_t to = claim_slot(from.hash(index), from.key(index), existed);
+        assert(!existed);
+        new (&slots.key(to)) TKey(HASHTABLE_MOVE(from.key(index)));
+        new (&slots.value(to)) TValue(HASHTABLE_MOVE(from.value(index)));
+        destroy(from, index);
+    }
 
-            free(old_entries);
+    // the hash is left alone, see find_old
+    static void destroy(TLayout<TKey, TValue> &in, uint32_t index) {
+        in.key(index).~TKey();
+        in.value(index).~TValue();
+    }
+
+    static void destroy_all(TLayout<TKey, TValue> &in, uint32_t in_size, uint32_t from) {
+        for (uint32_t i = from; i < in_size; ++i) {
+            if (in.hash(i)) {
+                destroy(in, i);
+            }
         }
     }
 
-    uint32_t dist_to_start(uint32_t hash, uint32_t index_stored) const {
+    // the size at which n entries fit without the table growing
+    uint32_t size_for(uint32_t n) const {
+        return next_pow2((uint32_t)(n / 0.85f) + 1);
+    }
+
+    uint32_t dist_to_start(uint32_t hash, uint32_t index_stored, uint32_t in_size) const {
         assert(hash != 0);
-        uint32_t start_index = hash & (size - 1);
+        uint32_t start_index = hash & (in_size - 1);
         if (start_index <= index_stored) {
             return index_stored - start_index;
         }
-        return index_stored + (size - start_index);
+        return index_stored + (in_size - start_index);
     }
 
-    uint32_t calc_hash(TKey key) const {
-        uint32_t hash = THashFunc()(key);
+    // put_all, hashing the keys unless key_hashes is given
+    void put_all_with(const TKey *keys, const TValue *values, uint32_t n, const uint32_t *key_hashes) {
+        // (unlike reserve, this does not stop the table shrinking again later)
+        uint32_t needed = size_for(used + old_used + n);
+        if (needed > size) {
+            resize(needed);
+        }
+
+        // counting sort by home slot (stable, to keep the order of duplicates)
+        uint32_t *hashes = (uint32_t *)malloc(sizeof(uint32_t) * n);
+        uint32_t *order = (uint32_t *)malloc(sizeof(uint32_t) * n);
+        uint32_t *starts = (uint32_t *)calloc(size + 1, sizeof(uint32_t));
+        for (uint32_t i = 0; i < n; ++i) {
+            hashes[i] = fix_hash(key_hashes ? key_hashes[i] : THashFunc()(keys[i]));
+            ++starts[(hashes[i] & (size - 1)) + 1];
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            starts[i + 1] += starts[i];
+        }
+        for (uint32_t i = 0; i < n; ++i) {
+            order[starts[hashes[i] & (size - 1)]++] = i;
+        }
+
+        for (uint32_t k = 0; k < n; ++k) {
+            uint32_t i = order[k];
+            uint32_t index;
+            if (find_old(hashes[i], keys[i], index)) {
+                count_lookup(true, hashes[i], index, old_size);
+                old_slots.value(index) = values[i];
+            } else {
+                put_new_or_assign(hashes[i], keys[i], values[i]);
+            }
+        }
+        free(hashes);
+        free(order);
+        free(starts);
+    }
+
+    uint32_t calc_hash(const TKey &key) const {
+        return fix_hash(THashFunc()(key));
+    }
+
+    // 0 marks empty slots
+    static uint32_t fix_hash(uint32_t hash) {
         return hash ? hash : 1;
     }
 
@@ -180,10 +790,9 @@ private:
         return v;
     }
 
-    // TODO: use C++ 11 and move semantics?
     template<typename T> void swap(T &a, T &b) {
-        T temp(a);
-        a = b;
-        b = temp;
+        T temp(HASHTABLE_MOVE(a));
+        a = HASHTABLE_MOVE(b);
+        b = HASHTABLE_MOVE(temp);
     }
 };
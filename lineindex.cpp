@@ -0,0 +1,97 @@
+
+// Byte offsets of the start of every line in the source text read into a module,
+// so source locations can be stored as plain offsets and only turned into
+// line/column when a message actually needs them.
+//
+// A line ends with "\n", "\r\n" or a lone "\r". Text may be added in pieces.
+class LineIndex {
+public:
+    LineIndex() : starts(NULL), count(0), capacity(0), total(0), pending_cr(false) {
+        push(0);
+    }
+
+    ~LineIndex() {
+        free(starts);
+    }
+
+    // number of bytes added so far (the offset the next text will start at)
+    uint32_t size() const {
+        return total;
+    }
+
+    void add(const char *text, uint32_t len) {
+        uint32_t i = 0;
+        if (pending_cr && len > 0) {
+            // a '\r' ended the previous piece; it was a line break unless this is "\r\n"
+            pending_cr = false;
+            if (text[0] != '\n') {
+                push(total);
+            }
+        }
+#if defined(__SSE2__)
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+            while (mask) {
+                line_break(text, len, i + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i < len; ++i) {
+            if (text[i] == '\n' || text[i] == '\r') {
+                line_break(text, len, i);
+            }
+        }
+        total += len;
+    }
+
+    SourceLoc lookup(uint32_t offset) const {
+        // last line starting at or before offset
+        uint32_t lo = 0;
+        uint32_t hi = count;
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (starts[mid] <= offset) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        return SourceLoc(lo, offset - starts[lo]);
+    }
+
+private:
+    LineIndex(const LineIndex &); // disallow
+    LineIndex &operator=(const LineIndex &); // disallow
+
+    uint32_t *starts;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t total;
+    bool pending_cr;
+
+    // text[i] is '\n' or '\r'
+    void line_break(const char *text, uint32_t len, uint32_t i) {
+        if (text[i] == '\r') {
+            if (i + 1 == len) {
+                pending_cr = true;
+                return;
+            }
+            if (text[i + 1] == '\n') {
+                return; // the '\n' ends the line
+            }
+        }
+        push(total + i + 1);
+    }
+
+    void push(uint32_t start) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            starts = (uint32_t *)realloc(starts, sizeof(uint32_t) * capacity);
+        }
+        starts[count++] = start;
+    }
+};
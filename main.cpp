@@ -5,6 +5,17 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <new>
+#if __cplusplus >= 201103L
+#include <utility>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <libtcc.h>
 
@@ -19,8 +30,10 @@ void fatal_error(const char *fmt, ...) {
 
 #include "stdstub.cpp"
 #include "murmur3.cpp"
+#include "wyhash.cpp"
 #include "functors.cpp"
 #include "hashtable.cpp"
+#include "swisstable.cpp"
 #include "arena.cpp"
 #include "types.cpp"
 
@@ -33,14 +46,76 @@ struct SourceLoc {
     SourceLoc(uint32_t line, uint32_t col) : line(line), col(col) {}
 };
 
-typedef HashTable<const char *, Box<Symbol> *> SymbolTable;
+#include "lineindex.cpp"
+#include "diagnostics.cpp"
+#include "concurrentsymboltable.cpp"
+
+typedef HashTable<StringRef, Box<Symbol> *> SymbolTable;
 
 class Module;
 
 struct Context {
     Arena *arena;
     SymbolTable symbols;
+    Arena symbol_arena; // names and boxes of symbols, which live as long as symbols
     Module *module;
+
+    // if set, errors in the source are collected rather than fatal (see Diagnostics)
+    Diagnostics *diagnostics;
+
+    // if set, symbols are interned here instead of in symbols, which lets contexts
+    // used by different threads share one set of symbols (see share_symbols)
+    ConcurrentSymbolTable *shared_symbols;
+
+    Context() : arena(NULL), module(NULL), diagnostics(NULL), shared_symbols(NULL), owned_symbols(NULL) {
+        const uint32_t n = NUM_KEYWORDS - (KW_NONE + 1);
+        StringRef names[n];
+        uint32_t hashes[n];
+        for (uint32_t i = 0; i < n; ++i) {
+            Symbol &sym = KEYWORD_SYMBOLS[KW_NONE + 1 + i]->value;
+            names[i] = StringRef(sym.data, (uint32_t)sym.length);
+        }
+        Hash<StringRef>().hash_all(names, n, hashes);
+        symbols.put_all_hashed(hashes, names, KEYWORD_SYMBOLS + KW_NONE + 1, n);
+    }
+
+    ~Context() {
+        delete owned_symbols;
+    }
+
+    // move to a ConcurrentSymbolTable, for other contexts to set as their
+    // shared_symbols. symbols interned so far stay the same.
+    void share_symbols() {
+        if (shared_symbols) {
+            return;
+        }
+        owned_symbols = new ConcurrentSymbolTable();
+        uint32_t n = symbols.count();
+        StringRef *names = (StringRef *)malloc(sizeof(StringRef) * n);
+        Box<Symbol> **syms = (Box<Symbol> **)malloc(sizeof(Box<Symbol> *) * n);
+        uint32_t *hashes = (uint32_t *)malloc(sizeof(uint32_t) * n);
+        uint32_t i = 0;
+        for (SymbolTable::Iterator it(symbols); it.valid(); it.next()) {
+            names[i] = it.key();
+            syms[i] = it.value();
+            ++i;
+        }
+        assert(i == n);
+        Hash<StringRef>().hash_all(names, n, hashes);
+        for (i = 0; i < n; ++i) {
+            owned_symbols->add(syms[i], hashes[i]);
+        }
+        free(names);
+        free(syms);
+        free(hashes);
+        shared_symbols = owned_symbols;
+    }
+
+private:
+    Context(const Context &); // disallow
+    Context &operator=(const Context &); // disallow
+
+    ConcurrentSymbolTable *owned_symbols;
 };
 
 
@@ -53,21 +128,39 @@ inline Ptr<T> box(Context *ctx, T value) {
     return box;
 }
 
-Ptr<Symbol> symbol(Context *ctx, const char *name) {
+// hash is Hash<StringRef> of name, so that name is hashed only once
+Ptr<Symbol> symbol(Context *ctx, StringRef name, uint32_t hash) {
+    if (ctx->shared_symbols) {
+        return ctx->shared_symbols->intern(name, hash);
+    }
+
     Box<Symbol> *sym;
-    if (ctx->symbols.get(name, sym)) {
+    if (ctx->symbols.get_hashed(hash, name, sym)) {
         return sym;
     }
 
-    size_t name_len = strlen(name);
-    char *name_copy = ctx->arena->alloc(name_len + 1);
-    memcpy(name_copy, name, name_len + 1);
+    // not in ctx->arena, so rolling that back (see Arena::rollback) leaves the table valid
+    char *name_copy = ctx->symbol_arena.alloc(name.length + 1);
+    memcpy(name_copy, name.data, name.length);
+    name_copy[name.length] = '\0';
 
-    sym = box(ctx, Symbol((int)name_len, name_copy));
-    ctx->symbols.put(name_copy, sym);
+    sym = ctx->symbol_arena.alloc< Box<Symbol> >();
+    sym->type = &type_Symbol.value;
+    sym->value = Symbol((int)name.length, name_copy);
+    ctx->symbols.put_hashed(hash, StringRef(name_copy, name.length), sym);
     return sym;
 }
 
+// name does not need to be NUL-terminated; it is only copied the first time it is seen
+Ptr<Symbol> symbol(Context *ctx, const char *name, uint32_t name_len) {
+    StringRef ref(name, name_len);
+    return symbol(ctx, ref, Hash<StringRef>()(ref));
+}
+
+Ptr<Symbol> symbol(Context *ctx, const char *name) {
+    return symbol(ctx, name, (uint32_t)strlen(name));
+}
+
 Ptr<String> string(Context *ctx, const char *text) {
     size_t text_len = strlen(text);
     char *text_copy = ctx->arena->alloc(text_len + 1);
@@ -75,9 +168,38 @@ Ptr<String> string(Context *ctx, const char *text) {
     return box(ctx, String((int)text_len, text_copy));
 }
 
+Ptr<String> string(Context *ctx, StringBuilder &builder) {
+    char *data = builder.finish();
+    return box(ctx, String((int)builder.length(), (int)builder.capacity(), data));
+}
+
 inline Ptr<Cons> cons(Context *ctx, Any *car, Any *cdr) {
     return box(ctx, Cons(car, cdr));
 }
+
+// Source locations of read forms are kept next to the conses holding them rather
+// than in a table: a located cons is allocated with the byte offset of its car
+// (see LineIndex) in the word just before its box.
+const size_t LOCATION_SIZE = sizeof(void *);
+
+inline Ptr<Cons> located_cons(Context *ctx, Any *car, Any *cdr, uint32_t offset) {
+    char *data = ctx->arena->alloc(LOCATION_SIZE + sizeof(Box<Cons>));
+    *(uint32_t *)data = offset;
+    Box<Cons> *box = (Box<Cons> *)(data + LOCATION_SIZE);
+    box->type = &type_LocatedCons.value;
+    box->value = Cons(car, cdr);
+    return box;
+}
+
+// offset of the car of form, if form is a cons made by located_cons
+inline bool source_offset(Any *form, uint32_t &offset) {
+    if (form->type != &type_LocatedCons.value) {
+        return false;
+    }
+    offset = *(uint32_t *)((char *)form - LOCATION_SIZE);
+    return true;
+}
+
 inline Ptr<Cons> list(Context *ctx, Any *a) {
     return cons(ctx, a, &NIL);
 }
@@ -103,6 +225,10 @@ inline bool nilp(Any *form) {
 inline bool symbolp(Any *form) {
     return form->type->type == TYPE_SYMBOL;
 }
+// the KW_ constant if form is a keyword symbol, KW_NONE otherwise
+inline int keyword_id(Any *form) {
+    return symbolp(form) ? Ptr<Symbol>(form)->id : KW_NONE;
+}
 inline Any *car(Any *form) {
     return Ptr<Cons>(form)->car;
 }
@@ -122,15 +248,32 @@ struct Func {
     Box<Symbol> *name;
 };
 
-typedef HashTable<Any *, SourceLoc> LocationTable;
-
 class Module {
 public:
-    LocationTable locations;
+    LineIndex lines;
 };
 
+// Reports an error in the source text at offset (if located). If ctx has a recovery
+// point set, the error is recorded in ctx->diagnostics and unwinds to it; otherwise
+// it is printed and the process exits.
+void source_error(Context *ctx, bool located, uint32_t offset, const char *fmt, va_list args) {
+    char message[1024];
+    vsnprintf(message, sizeof(message), fmt, args);
+    Diagnostics *diagnostics = ctx->diagnostics;
+    if (diagnostics && diagnostics->recovery) {
+        diagnostics->add(located, offset, message);
+        longjmp(*diagnostics->recovery, 1);
+    }
+    Diagnostics::print(ctx->module->lines, located, offset, message);
+    exit(1);
+}
 
+
+#include "formscanner.cpp"
 #include "reader.cpp"
+#include "streamreader.cpp"
+#include "parallelreader.cpp"
+#include "formindex.cpp"
 #include "printer.cpp"
 
 
@@ -147,24 +290,70 @@ public:
 
     void parse_module(Any *list) {
         while (!nilp(list)) {
-            Any *form = car(list);
-            if (!consp(form)) {
-                parse_error(list, "only list forms are allowed at top-level");
-            }
-
-            Any *sym = car(form);
-            if (sym == symbol(ctx, "def")) {
-                parse_func(form);
+            if (ctx->diagnostics) {
+                parse_toplevel_recovering(list);
             } else {
-                parse_error(form, "expected a top-level definition");
+                parse_toplevel(list);
             }
-
             list = cdr(list);
         }
     }
 
+    // parse only the definition of name, reading just that form from the index
+    bool parse_definition(FormIndex &index, Box<Symbol> *name) {
+        uint32_t i;
+        if (!index.find(name, i)) {
+            return false;
+        }
+        Any *form = index.form(i);
+        if (nilp(form)) {
+            return false; // could not be read, see ctx->diagnostics
+        }
+        Any *list = cons(ctx, form, &NIL);
+        if (ctx->diagnostics) {
+            return parse_toplevel_recovering(list);
+        }
+        parse_toplevel(list);
+        return true;
+    }
+
+    // parse the top-level form car(list)
+    void parse_toplevel(Any *list) {
+        Any *form = car(list);
+        if (!consp(form)) {
+            parse_error(list, "only list forms are allowed at top-level");
+        }
+
+        switch (keyword_id(car(form))) {
+        case KW_DEF:
+            parse_func(form);
+            break;
+        default:
+            parse_error(form, "expected a top-level definition");
+        }
+    }
+
+    // like parse_toplevel, but on an error (which is recorded in ctx->diagnostics)
+    // frees what was allocated for the form and returns false
+    bool parse_toplevel_recovering(Any *list) {
+        Diagnostics *diagnostics = ctx->diagnostics;
+        jmp_buf *outer = diagnostics->recovery;
+        Arena::Mark mark = ctx->arena->mark();
+
+        jmp_buf recovery;
+        if (setjmp(recovery)) {
+            diagnostics->recovery = outer;
+            ctx->arena->rollback(mark);
+            return false;
+        }
+        diagnostics->recovery = &recovery;
+        parse_toplevel(list);
+        diagnostics->recovery = outer;
+        return true;
+    }
+
     void parse_func(Any *form) {
-        assert(car(form) == symbol(ctx, "def"));
+        assert(car(form) == &SYM_DEF);
         form = cdr(form);
 
         Any *generic_arglist = NULL;
@@ -186,7 +375,7 @@ public:
             parse_error(form, "expected argument list");
         }
         if (!nilp(arglist)) {
-            if (car(arglist) == symbol(ctx, "ascribe")) {
+            if (keyword_id(car(arglist)) == KW_ASCRIBE) {
                 Any *ascribeform = cdr(arglist);
                 arglist = car(ascribeform);
                 if (!consp(arglist)) {
@@ -199,25 +388,522 @@ public:
     }
 
     void parse_error(Any *containing_cons, const char *fmt, ...) {
-        SourceLoc loc;
-        if (module->locations.get(containing_cons, loc)) {
-            printf("line %d, col %d: ", loc.line + 1, loc.col + 1);
-        } else {
-            printf("unknown location: ");
-        }
+        uint32_t offset = 0;
+        bool located = source_offset(containing_cons, offset);
         va_list args;
         va_start(args, fmt);
-        vprintf(fmt, args);
+        source_error(ctx, located, offset, fmt, args);
         va_end(args);
-        printf("\n");
-        exit(1);
     }
 };
 
 
 
 
+#include "bench.cpp"
+
+
+struct FormCollector {
+    Context *ctx;
+    Any *head;
+    Box<Cons> *tail;
+};
+
+void collect_form(void *userdata, Any *form, uint32_t offset) {
+    FormCollector *collector = (FormCollector *)userdata;
+    Box<Cons> *next = located_cons(collector->ctx, form, &NIL, offset);
+    if (collector->tail) {
+        collector->tail->value.cdr = next;
+    } else {
+        collector->head = next;
+    }
+    collector->tail = next;
+}
+
+// Self-checks, run by main --check.
+
+// a string that owns a malloc'd copy, for checking tables whose keys need their
+// constructors and destructors run
+struct OwnedString {
+    char *data;
+
+    OwnedString() : data(strdup("")) {}
+    OwnedString(const char *s) : data(strdup(s)) {}
+    OwnedString(const OwnedString &other) : data(strdup(other.data)) {}
+    ~OwnedString() { free(data); }
+
+    OwnedString &operator=(const OwnedString &other) {
+        char *copy = strdup(other.data);
+        free(data);
+        data = copy;
+        return *this;
+    }
+};
+
+struct OwnedStringHash {
+    uint32_t operator()(const OwnedString &s) const { return Hash<const char *>()(s.data); }
+};
+
+struct OwnedStringEqual {
+    bool operator()(const OwnedString &a, const OwnedString &b) const { return strcmp(a.data, b.data) == 0; }
+};
+
+typedef HashTable<OwnedString, int, OwnedStringHash, OwnedStringEqual> OwnedStringTable;
+
+// puts and gets while incremental resizes are in progress
+void check_incremental_migration() {
+    // the last resize, to 4096 slots, is still being migrated after n puts
+    const int n = 1750;
+    OwnedStringTable table;
+    table.set_incremental_resize(true);
+    char name[32];
+    for (int i = 0; i < n; ++i) {
+        sprintf(name, "key%d", i);
+        table.put(name, i);
+        // the key may already have been moved out of the old slots
+        sprintf(name, "key%d", i / 2);
+        table.put(name, i / 2);
+        int value = -1;
+        assert(table.get(name, value));
+        assert(value == i / 2);
+        assert(!table.get("missing", value));
+    }
+    // a resize is still being migrated, which lookups leave alone
+    int *value = table.lookup("key1749");
+    assert(value && *value == n - 1);
+    for (int i = 0; i < n; ++i) {
+        sprintf(name, "key%d", i);
+        assert(table.lookup(name));
+    }
+    assert(table.lookup("key1749") == value);
+
+    for (int i = 0; i < n; i += 3) {
+        sprintf(name, "key%d", i);
+        table.put(name, -i);
+    }
+    for (int i = 0; i < n; ++i) {
+        sprintf(name, "key%d", i);
+        int value;
+        assert(table.get(name, value));
+        assert(value == (i % 3 ? i : -i));
+    }
+}
+
+// quotes and type ascriptions nested past Reader::MAX_DEPTH fail with an error
+void check_reader_depth() {
+    const uint32_t n = 20000;
+    char *quotes = (char *)malloc(n + 2);
+    memset(quotes, '\'', n);
+    strcpy(quotes + n, "x");
+    char *ascriptions = (char *)malloc(n * 4 + 2);
+    strcpy(ascriptions, "x");
+    for (uint32_t i = 0; i < n; ++i) {
+        strcat(ascriptions + i * 4, " : t");
+    }
+    const char *texts[] = { quotes, ascriptions };
+    for (int i = 0; i < 2; ++i) {
+        Arena arena;
+        Module module;
+        Diagnostics diagnostics;
+        Context ctx;
+        ctx.arena = &arena;
+        ctx.module = &module;
+        ctx.diagnostics = &diagnostics;
+        Reader reader(&ctx);
+        assert(nilp(reader.read_file(texts[i])));
+        assert(diagnostics.size() == 1);
+        assert(strcmp(diagnostics.entry(0).message, "forms are nested too deeply") == 0);
+    }
+    free(quotes);
+    free(ascriptions);
+}
+
+// iterating while a resize is being migrated visits every entry once, whether it
+// is still in the old slots or already in the new ones
+void check_iteration_during_migration() {
+    // the resize to 4096 slots happens at the 1742nd put
+    const int n = 1750;
+    OwnedStringTable table;
+    table.set_incremental_resize(true);
+    char name[32];
+    for (int i = 0; i < n; ++i) {
+        sprintf(name, "key%d", i);
+        table.put(name, i);
+    }
+    int seen[n] = { 0 };
+    for (OwnedStringTable::Iterator it(table); it.valid(); it.next()) {
+        int i = it.value();
+        sprintf(name, "key%d", i);
+        assert(strcmp(it.key().data, name) == 0);
+        ++seen[i];
+    }
+    for (int i = 0; i < n; ++i) {
+        assert(seen[i] == 1);
+    }
+}
+
+// the same puts, removes and gets on both layouts, through growing and shrinking,
+// give the same results
+void check_layouts() {
+    OwnedStringTable interleaved;
+    HashTable<OwnedString, int, OwnedStringHash, OwnedStringEqual, SplitLayout> split;
+    uint32_t seed = 1;
+    char name[32];
+    for (int i = 0; i < 40000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        sprintf(name, "key%u", r % 2000);
+        // phases of mostly puts and of only removes
+        uint32_t op = (r >> 12) % 4;
+        bool removing = (i / 10000) % 2 == 1;
+        if (op <= 1 && !removing) {
+            interleaved.put(name, i);
+            split.put(name, i);
+        } else if (op <= 2) {
+            assert(interleaved.remove(name) == split.remove(name));
+        } else {
+            int a = -1, b = -1;
+            assert(interleaved.get(name, a) == split.get(name, b));
+            assert(a == b);
+        }
+    }
+
+    uint32_t count = 0;
+    for (OwnedStringTable::Iterator it(interleaved); it.valid(); it.next()) {
+        int value;
+        assert(split.get(it.key(), value));
+        assert(value == it.value());
+        ++count;
+    }
+    for (HashTable<OwnedString, int, OwnedStringHash, OwnedStringEqual, SplitLayout>::Iterator it(split);
+         it.valid(); it.next()) {
+        --count;
+    }
+    assert(count == 0);
+}
+
+// a table built with put_all, where of duplicate keys the last value wins, and
+// then shrunk by removing most of it
+void check_put_all_and_shrink() {
+    const uint32_t n = 1000;
+    char (*names)[16] = (char (*)[16])malloc(sizeof(*names) * n);
+    StringRef *keys = (StringRef *)malloc(sizeof(StringRef) * (n + n / 2));
+    int *values = (int *)malloc(sizeof(int) * (n + n / 2));
+    for (uint32_t i = 0; i < n; ++i) {
+        sprintf(names[i], "key%u", i);
+        keys[i] = StringRef(names[i], (uint32_t)strlen(names[i]));
+        values[i] = -1;
+    }
+    // every other key again, with its final value
+    for (uint32_t i = 0; i < n; i += 2) {
+        keys[n + i / 2] = keys[i];
+        values[n + i / 2] = (int)i;
+    }
+    for (uint32_t i = 1; i < n; i += 2) {
+        values[i] = (int)i;
+    }
+
+    HashTable<StringRef, int> table;
+    table.put_all(keys, values, n + n / 2);
+    for (uint32_t i = 0; i < n; ++i) {
+        int value;
+        assert(table.get(keys[i], value));
+        assert(value == (int)i);
+    }
+
+    // down to 20 of 1000 entries, which halves the table several times
+    for (uint32_t i = 0; i < n; ++i) {
+        if (i % 50) {
+            assert(table.remove(keys[i]));
+        }
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        int value = -1;
+        assert(table.get(keys[i], value) == (i % 50 == 0));
+        assert(i % 50 || value == (int)i);
+    }
+    free(names);
+    free(keys);
+    free(values);
+}
+
+// hash_all gives the hashes one call per key would, for every length wyhash
+// handles differently and at every alignment, and put_all_hashed with those
+// fills a table as put_all does
+void check_hash_all() {
+    const uint32_t max_len = 100;
+    const uint32_t n = 8 * (max_len + 1);
+    char text[max_len + 8];
+    for (uint32_t i = 0; i < sizeof(text); ++i) {
+        text[i] = (char)('a' + i * 7 % 26);
+    }
+    StringRef *keys = (StringRef *)malloc(sizeof(StringRef) * n);
+    uint32_t *hashes = (uint32_t *)malloc(sizeof(uint32_t) * n);
+    int *values = (int *)malloc(sizeof(int) * n);
+    for (uint32_t i = 0; i < n; ++i) {
+        keys[i] = StringRef(text + i % 8, i / 8);
+        values[i] = (int)i;
+    }
+    Hash<StringRef> hash;
+    hash.hash_all(keys, n, hashes);
+    for (uint32_t i = 0; i < n; ++i) {
+        assert(hashes[i] == hash(keys[i]));
+    }
+
+    HashTable<StringRef, int> table;
+    HashTable<StringRef, int> hashed;
+    table.put_all(keys, values, n);
+    hashed.put_all_hashed(hashes, keys, values, n);
+    assert(hashed.count() == table.count());
+    for (uint32_t i = 0; i < n; ++i) {
+        int a = -1;
+        int b = -1;
+        assert(table.get(keys[i], a) && hashed.get(keys[i], b));
+        assert(a == b);
+    }
+    free(keys);
+    free(hashes);
+    free(values);
+}
+
+// emplace and remove with keys and values that own memory, while incremental
+// resizes are in progress
+void check_emplace_remove() {
+    const int n = 1000;
+    HashTable<OwnedString, OwnedString, OwnedStringHash, OwnedStringEqual> table;
+    table.set_incremental_resize(true);
+    bool removed[n] = { false };
+    char name[32];
+    char text[32];
+    for (int i = 0; i < n; ++i) {
+        sprintf(name, "key%d", i);
+        sprintf(text, "value%d", i);
+        OwnedString &value = table.emplace(name);
+        assert(value.data[0] == '\0');
+        value = text;
+        // emplacing it again finds the value
+        assert(strcmp(table.emplace(name).data, text) == 0);
+
+        if (i % 3 == 0) {
+            int k = i / 2;
+            sprintf(name, "key%d", k);
+            assert(table.remove(name) == !removed[k]);
+            removed[k] = true;
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        sprintf(name, "key%d", i);
+        sprintf(text, "value%d", i);
+        OwnedString *value = table.lookup(name);
+        assert(!value == removed[i]);
+        assert(!value || strcmp(value->data, text) == 0);
+    }
+}
+
+struct InternThread {
+    ConcurrentSymbolTable *table;
+    StringRef *names;
+    uint32_t n;
+    bool backwards;
+    Box<Symbol> **out;
+};
+
+void *intern_all(void *arg) {
+    InternThread *t = (InternThread *)arg;
+    for (uint32_t k = 0; k < t->n; ++k) {
+        uint32_t i = t->backwards ? t->n - 1 - k : k;
+        t->out[i] = t->table->intern(t->names[i], Hash<StringRef>()(t->names[i]));
+    }
+    return NULL;
+}
+
+// two threads interning the same names, in opposite orders and through several
+// resizes, get the same symbols
+void check_concurrent_intern() {
+    const uint32_t n = 20000;
+    char (*text)[16] = (char (*)[16])malloc(sizeof(*text) * n);
+    StringRef *names = (StringRef *)malloc(sizeof(StringRef) * n);
+    for (uint32_t i = 0; i < n; ++i) {
+        sprintf(text[i], "name%u", i);
+        names[i] = StringRef(text[i], (uint32_t)strlen(text[i]));
+    }
+
+    ConcurrentSymbolTable table(32);
+    InternThread threads[2];
+    pthread_t ids[2];
+    for (int i = 0; i < 2; ++i) {
+        threads[i].table = &table;
+        threads[i].names = names;
+        threads[i].n = n;
+        threads[i].backwards = i == 1;
+        threads[i].out = (Box<Symbol> **)malloc(sizeof(Box<Symbol> *) * n);
+        if (pthread_create(&ids[i], NULL, intern_all, &threads[i]) != 0) {
+            fatal_error("could not create intern thread");
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        pthread_join(ids[i], NULL);
+    }
+
+    assert(table.size() == n);
+    for (uint32_t i = 0; i < n; ++i) {
+        Box<Symbol> *sym = threads[0].out[i];
+        assert(sym == threads[1].out[i]);
+        assert(sym == table.find(names[i], Hash<StringRef>()(names[i])));
+        assert(strcmp(sym->value.data, text[i]) == 0);
+    }
+    free(threads[0].out);
+    free(threads[1].out);
+    free(names);
+    free(text);
+}
+
+template<typename T>
+bool same_value(Any *a, Any *b) {
+    return *Ptr<T>(a) == *Ptr<T>(b);
+}
+
+// the same structure and atoms, wherever and however they were read
+bool same_forms(Any *a, Any *b) {
+    while (a != &NIL && b != &NIL && consp(a) && consp(b)) {
+        if (!same_forms(car(a), car(b))) {
+            return false;
+        }
+        a = cdr(a);
+        b = cdr(b);
+    }
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type->type) {
+    case TYPE_CONS: return a == b; // both NIL
+    case TYPE_BOOL: return a == b;
+    case TYPE_SYMBOL: return strcmp(Ptr<Symbol>(a)->data, Ptr<Symbol>(b)->data) == 0;
+    case TYPE_STRING: return strcmp(Ptr<String>(a)->data, Ptr<String>(b)->data) == 0;
+    case TYPE_I8: return same_value<i8>(a, b);
+    case TYPE_I16: return same_value<i16>(a, b);
+    case TYPE_I32: return same_value<i32>(a, b);
+    case TYPE_I64: return same_value<i64>(a, b);
+    case TYPE_U8: return same_value<u8>(a, b);
+    case TYPE_U16: return same_value<u16>(a, b);
+    case TYPE_U32: return same_value<u32>(a, b);
+    case TYPE_U64: return same_value<u64>(a, b);
+    case TYPE_F32: return same_value<f32>(a, b);
+    case TYPE_F64: return same_value<f64>(a, b);
+    default: return false;
+    }
+}
+
+// text fed to a StreamReader a few bytes at a time, so that tokens, strings and
+// comments are split across chunks, gives the same forms as reading it at once
+void check_stream_chunks() {
+    const char *text =
+        "(def foo (x y) (+ x y 123u32 55.6)) ; a comment (with brackets\n"
+        "\"a string (with \\\" brackets) ; and no comment\"\n"
+        "a_rather_long_symbol_name.with_a_prop[1 2] : i32\n"
+        "'quoted ; only a comment\n"
+        "(nested (lists [here]) \"and \\\\ strings\")\n"
+        "0x1F 0123.5 -7i8 #t";
+    uint32_t len = (uint32_t)strlen(text);
+
+    Arena arena;
+    Module module;
+    Context ctx;
+    ctx.arena = &arena;
+    ctx.module = &module;
+    Reader reader(&ctx);
+    Any *expected = reader.read_file(text, len);
+    assert(!nilp(expected));
+
+    for (uint32_t chunk = 1; chunk <= 7; ++chunk) {
+        FormCollector collector = { &ctx, &NIL, NULL };
+        StreamReader stream_reader(&ctx, collect_form, &collector);
+        for (uint32_t pos = 0; pos < len; pos += chunk) {
+            stream_reader.feed(text + pos, len - pos < chunk ? len - pos : chunk);
+        }
+        stream_reader.finish();
+        assert(same_forms(collector.head, expected));
+    }
+}
+
+// a ParallelReader splitting a small text between up to 8 threads, so that the
+// split points fall inside lists, strings and comments, gives the same forms as
+// a Reader
+void check_parallel_split() {
+    const char *text =
+        "(def foo (x y)\n"
+        "  ; a comment (with brackets \" and a quote\n"
+        "  (+ x y \"a string ) with ; brackets\" 123u32 55.6))\n"
+        "(def bar () [1 2 3] 'quoted)\n"
+        "a_symbol.with_a_prop : i32\n"
+        "(one (long (nested (form \"that\" spans) several) split) points)\n"
+        "0x1F 0123.5 -7i8 #t";
+    uint32_t len = (uint32_t)strlen(text);
+
+    Arena arena;
+    Module module;
+    Context ctx;
+    ctx.arena = &arena;
+    ctx.module = &module;
+    Reader reader(&ctx);
+    Any *expected = reader.read_file(text, len);
+    assert(!nilp(expected));
+
+    for (uint32_t threads = 2; threads <= 8; ++threads) {
+        ParallelReader parallel_reader(&ctx, threads, 16);
+        assert(same_forms(parallel_reader.read_file(text, len), expected));
+    }
+}
+
+// number literals with a leading 0 are octal, unless they are floats
+void check_number_literals() {
+    Arena arena;
+    Module module;
+    Context ctx;
+    ctx.arena = &arena;
+    ctx.module = &module;
+    Reader reader(&ctx);
+    Any *forms = reader.read_file("0123 0123.5 0129.5 012E3 0e5 1e5 0x1F");
+    assert(Ptr<i64>(car(forms)) == 83);
+    forms = cdr(forms);
+    assert(Ptr<f64>(car(forms)) == 123.5);
+    forms = cdr(forms);
+    assert(Ptr<f64>(car(forms)) == 129.5);
+    forms = cdr(forms);
+    assert(Ptr<f64>(car(forms)) == 12000.0);
+    forms = cdr(forms);
+    assert(Ptr<f64>(car(forms)) == 0.0);
+    forms = cdr(forms);
+    assert(Ptr<f64>(car(forms)) == 100000.0);
+    forms = cdr(forms);
+    assert(Ptr<i64>(car(forms)) == 31);
+    assert(nilp(cdr(forms)));
+}
+
+void run_checks() {
+    check_incremental_migration();
+    check_iteration_during_migration();
+    check_layouts();
+    check_put_all_and_shrink();
+    check_hash_all();
+    check_emplace_remove();
+    check_concurrent_intern();
+    check_stream_chunks();
+    check_parallel_split();
+    check_reader_depth();
+    check_number_literals();
+}
+
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return run_benchmarks();
+    }
+    if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+        run_checks();
+        printf("all checks passed\n");
+        return 0;
+    }
+
     HashTable<const char *, int> hashtable;
 
     hashtable.put("foo", 99);
@@ -233,6 +919,10 @@ int main(int argc, char *argv[]) {
     assert(val == 435);
     found = hashtable.get("baz", val);
     assert(!found);
+    StringRef foo_ref("foobar", 3);
+    found = hashtable.get_hashed(Hash<const char *>()(foo_ref), foo_ref, val);
+    assert(found);
+    assert(val == 99);
     hashtable.remove("bar");
     found = hashtable.get("bar", val);
     assert(!found);
@@ -249,11 +939,63 @@ int main(int argc, char *argv[]) {
     assert(symbol(&ctx, strdup("foo")) == symbol(&ctx, "foo"));
     assert(symbol(&ctx, "bar") == symbol(&ctx, "bar"));
     assert(symbol(&ctx, "foo") != symbol(&ctx, "bar"));
+    assert(symbol(&ctx, "def") == Ptr<Symbol>(&SYM_DEF));
+    assert(keyword_id(symbol(&ctx, "ascribe")) == KW_ASCRIBE);
+    assert(keyword_id(symbol(&ctx, "foo")) == KW_NONE);
 
-    Reader reader(&ctx);
-    Any *form = reader.read_file(
-        "(def foo (x y) (+ x y 123u32 55.6))\n"
-    );
+    // usage: main [-k] [-j threads | -d name] [file | -], or main --bench, or
+    // main --check
+    // (-k reports all errors in the source rather than stopping at the first)
+    uint32_t num_threads = 1;
+    const char *def_name = NULL;
+    Diagnostics diagnostics;
+    int arg = 1;
+    while (arg < argc) {
+        if (strcmp(argv[arg], "-k") == 0) {
+            ctx.diagnostics = &diagnostics;
+            arg += 1;
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-j") == 0) {
+            num_threads = (uint32_t)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-d") == 0) {
+            def_name = argv[arg + 1];
+            arg += 2;
+        } else {
+            break;
+        }
+    }
+    const char *path = arg < argc ? argv[arg] : NULL;
+
+    const char *default_text = "(def foo (x y) (+ x y 123u32 55.6))\n";
+    FormIndex index(&ctx);
+    Any *form;
+    if (def_name) {
+        // read only the named definition
+        if (path) {
+            index.index_path(path);
+        } else {
+            index.index_file(default_text, (uint32_t)strlen(default_text));
+        }
+        uint32_t i;
+        if (!index.find(symbol(&ctx, def_name), i)) {
+            fatal_error("no definition of %s", def_name);
+        }
+        form = index.form(i);
+    } else if (path && strcmp(path, "-") == 0) {
+        FormCollector collector = { &ctx, &NIL, NULL };
+        StreamReader stream_reader(&ctx, collect_form, &collector);
+        stream_reader.read_fd(0);
+        form = collector.head;
+    } else if (path && num_threads != 1) {
+        ParallelReader parallel_reader(&ctx, num_threads);
+        form = parallel_reader.read_path(path);
+    } else if (path) {
+        Reader reader(&ctx);
+        form = reader.read_path(path);
+    } else {
+        Reader reader(&ctx);
+        form = reader.read_file(default_text);
+    }
     assert(form);
 
     Printer printer(&ctx);
@@ -261,7 +1003,21 @@ int main(int argc, char *argv[]) {
     printf("\n");
 
     Parser parser(&ctx);
-    parser.parse_module(form);
+    if (def_name) {
+        parser.parse_definition(index, symbol(&ctx, def_name));
+    } else {
+        parser.parse_module(form);
+    }
+#ifdef HASHTABLE_STATS
+    ctx.symbols.print_stats(stderr, "symbols");
+    if (def_name) {
+        index.print_stats(stderr);
+    }
+#endif
+    if (diagnostics.size()) {
+        diagnostics.print(module.lines);
+        return 1;
+    }
 
 
 
@@ -0,0 +1,155 @@
+
+// Reads a whole file using several threads.
+//
+// A quick FormScanner pass finds the top-level form boundaries closest to evenly
+// spaced split points, and each range between them is read by its own thread into
+// its own Arena (the module's LineIndex is built before the threads start, and only
+// read by them). Symbols are interned in one ConcurrentSymbolTable shared by all
+// threads and ctx (see Context::share_symbols), so symbol identity holds across
+// threads. Afterwards the arenas are merged into
+// ctx, and the lists of top-level forms are linked together in source order.
+class ParallelReader {
+public:
+    // inputs are only split into ranges of at least min_bytes_per_thread
+    ParallelReader(Context *ctx, uint32_t num_threads = 0,
+                   uint32_t min_bytes_per_thread = MIN_BYTES_PER_THREAD)
+    : ctx(ctx), module(ctx->module), num_threads(num_threads),
+      min_bytes_per_thread(min_bytes_per_thread) {
+        if (!this->num_threads) {
+            long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            this->num_threads = num_cpus > 0 ? (uint32_t)num_cpus : 1;
+        }
+    }
+
+    Any *read_path(const char *path) {
+        MappedFile file(path);
+        return read_file(file.data(), file.size());
+    }
+
+    Any *read_file(const char *text, uint32_t len) {
+        // not worth starting threads for small inputs
+        uint32_t max_workers = num_threads;
+        if (max_workers > len / min_bytes_per_thread) {
+            max_workers = len / min_bytes_per_thread;
+        }
+        if (max_workers <= 1) {
+            Reader reader(ctx);
+            return reader.read_file(text, len);
+        }
+
+        uint32_t base = module->lines.size();
+        module->lines.add(text, len);
+        ctx->share_symbols();
+
+        Worker *workers = new Worker[max_workers];
+        uint32_t num_workers = split(text, len, workers, max_workers);
+
+        for (uint32_t i = 0; i < num_workers; ++i) {
+            Worker &w = workers[i];
+            w.text = text;
+            w.base = base;
+            w.ctx.arena = &w.arena;
+            w.ctx.module = module;
+            w.ctx.shared_symbols = ctx->shared_symbols;
+            w.ctx.diagnostics = ctx->diagnostics ? &w.diagnostics : NULL;
+            if (i > 0) {
+                if (pthread_create(&w.thread, NULL, run_worker, &w) != 0) {
+                    fatal_error("could not create reader thread");
+                }
+            }
+        }
+        run_worker(&workers[0]);
+
+        Any *result = &NIL;
+        Box<Cons> *tail = NULL;
+        for (uint32_t i = 0; i < num_workers; ++i) {
+            Worker &w = workers[i];
+            if (i > 0) {
+                pthread_join(w.thread, NULL);
+            }
+            ctx->arena->absorb(w.arena);
+            if (ctx->diagnostics) {
+                ctx->diagnostics->append(w.diagnostics);
+            }
+
+            if (nilp(w.result)) {
+                continue;
+            }
+            if (tail) {
+                tail->value.cdr = w.result;
+            } else {
+                result = w.result;
+            }
+            tail = Ptr<Cons>(w.result);
+            while (!nilp(tail->value.cdr)) {
+                tail = Ptr<Cons>(tail->value.cdr);
+            }
+        }
+
+        delete[] workers;
+        return result;
+    }
+
+private:
+    ParallelReader(const ParallelReader &); // disallow
+    ParallelReader &operator=(const ParallelReader &); // disallow
+
+    static const uint32_t MIN_BYTES_PER_THREAD = 64 * 1024;
+
+    struct Worker {
+        const char *text;
+        uint32_t start;
+        uint32_t end;
+        uint32_t base; // source offset of text
+
+        Arena arena;
+        Context ctx;
+        Diagnostics diagnostics;
+        pthread_t thread;
+
+        Any *result;
+    };
+
+    Context *ctx;
+    Module *module;
+    uint32_t num_threads;
+    uint32_t min_bytes_per_thread;
+
+    static void *run_worker(void *arg) {
+        Worker *w = (Worker *)arg;
+        Reader reader(&w->ctx);
+        w->result = reader.read_file(w->text + w->start, w->end - w->start, w->base + w->start);
+        return NULL;
+    }
+
+    // divide text into at most max_workers ranges that each hold whole top-level forms,
+    // returning the number of ranges
+    uint32_t split(const char *text, uint32_t len, Worker *workers, uint32_t max_workers) {
+        FormScanner scanner;
+        uint32_t pos = 0;
+        uint32_t count = 1;
+        workers[0].start = 0;
+        for (uint32_t k = 1; k < max_workers && pos < len; ++k) {
+            uint32_t target = (uint32_t)((uint64_t)len * k / max_workers);
+            if (pos >= target) {
+                continue; // the last form spanned this split point too
+            }
+            bool found = false;
+            while (scanner.scan(text, pos, len)) {
+                if (pos >= target) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found || pos >= len) {
+                break;
+            }
+            workers[count++].start = pos;
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            workers[i].end = i + 1 < count ? workers[i + 1].start : len;
+        }
+        return count;
+    }
+};
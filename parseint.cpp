@@ -0,0 +1,92 @@
+
+// Integer literal parsing for the reader. This works on
+// length-bounded text, takes no sign, and converts eight digits at a time
+// with SWAR (SIMD within a register) arithmetic. Assumes a little-endian target.
+
+inline uint64_t load_u64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// true if all 8 bytes are '0'..'9'
+inline bool swar_is_eight_digits(uint64_t v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+// value of 8 decimal digits, first digit in the lowest byte
+inline uint32_t swar_eight_digits(uint64_t v) {
+    v = ((v & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;                 // pairs
+    v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;             // quads
+    return (uint32_t)(((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+
+// value of 8 hex digits (already validated), first digit in the lowest byte
+inline uint32_t swar_eight_hex_digits(uint64_t v) {
+    // '0'..'9' have bit 6 clear, 'a'..'f' and 'A'..'F' have it set and need 9 added
+    v = (v & 0x0F0F0F0F0F0F0F0FULL) + 9 * ((v >> 6) & 0x0101010101010101ULL);
+    v = ((v & 0x00FF00FF00FF00FFULL) << 4) | ((v >> 8) & 0x00FF00FF00FF00FFULL);
+    v = ((v & 0x0000FFFF0000FFFFULL) << 8) | ((v >> 16) & 0x0000FFFF0000FFFFULL);
+    return (uint32_t)(((v & 0xFFFFFFFFULL) << 16) | (v >> 32));
+}
+
+inline uint32_t hex_digit_value(char ch) {
+    return (ch & 0x0F) + 9 * ((ch >> 6) & 1);
+}
+
+// Parses the digits of an unsigned integer in text[0..len): hexadecimal after "0x",
+// octal after a leading '0', decimal otherwise. Returns the number of chars consumed
+// (0 if there are no digits). Sets overflow if the value doesn't fit in 64 bits.
+uint32_t parse_uint(const char *text, uint32_t len, uint64_t &value_out, bool &overflow_out) {
+    uint64_t value = 0;
+    bool overflow = false;
+    uint32_t i = 0;
+
+    if (len >= 3 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X') && char_is(text[2], CHAR_HEX)) {
+        i = 2;
+        while (i + 8 <= len) {
+            uint32_t k = 0;
+            while (k < 8 && char_is(text[i + k], CHAR_HEX)) {
+                ++k;
+            }
+            if (k < 8) {
+                break;
+            }
+            overflow |= (value >> 32) != 0;
+            value = (value << 32) | swar_eight_hex_digits(load_u64(text + i));
+            i += 8;
+        }
+        while (i < len && char_is(text[i], CHAR_HEX)) {
+            overflow |= (value >> 60) != 0;
+            value = (value << 4) | hex_digit_value(text[i]);
+            ++i;
+        }
+    } else if (len >= 2 && text[0] == '0' && char_is(text[1], CHAR_DIGIT)) {
+        i = 1;
+        while (i < len && text[i] >= '0' && text[i] <= '7') {
+            overflow |= (value >> 61) != 0;
+            value = (value << 3) | (uint64_t)(text[i] - '0');
+            ++i;
+        }
+    } else {
+        while (i + 8 <= len) {
+            uint64_t chunk = load_u64(text + i);
+            if (!swar_is_eight_digits(chunk)) {
+                break;
+            }
+            overflow |= __builtin_mul_overflow(value, (uint64_t)100000000, &value);
+            overflow |= __builtin_add_overflow(value, (uint64_t)swar_eight_digits(chunk), &value);
+            i += 8;
+        }
+        while (i < len && char_is(text[i], CHAR_DIGIT)) {
+            overflow |= __builtin_mul_overflow(value, (uint64_t)10, &value);
+            overflow |= __builtin_add_overflow(value, (uint64_t)(text[i] - '0'), &value);
+            ++i;
+        }
+    }
+
+    value_out = value;
+    overflow_out = overflow;
+    return i;
+}
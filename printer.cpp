@@ -33,8 +33,9 @@ private:
 
                 // try to preserve whitespace when printing forms that were read
                 // (for which we remember the locations of the car forms of all conses)
-                SourceLoc loc;
-                if (module->locations.get(cons, loc)) {
+                uint32_t offset;
+                if (source_offset(form, offset)) {
+                    SourceLoc loc = module->lines.lookup(offset);
                     if (last_line < loc.line) {
                         do {
                             printf("\n");
@@ -1,33 +1,117 @@
 
 #include <limits.h>
 #include <ctype.h>
-#include "strtoll.cpp"
-#include "strtod.cpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "charclass.cpp"
+#include "parseint.cpp"
+#include "parsefloat.cpp"
+
+// read-only mapping of a whole file
+class MappedFile {
+public:
+    MappedFile(const char *path) : text(""), len(0) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fatal_error("could not open file: %s", path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            fatal_error("could not stat file: %s", path);
+        }
+        if ((uint64_t)st.st_size > UINT32_MAX) {
+            close(fd);
+            fatal_error("file is too large: %s", path);
+        }
+        len = (uint32_t)st.st_size;
+        if (len == 0) {
+            close(fd);
+            return;
+        }
+        void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            fatal_error("could not map file: %s", path);
+        }
+        madvise(data, len, MADV_SEQUENTIAL);
+        text = (const char *)data;
+    }
+
+    ~MappedFile() {
+        if (len) {
+            munmap((void *)text, len);
+        }
+    }
+
+    // not NUL-terminated
+    const char *data() const { return text; }
+    uint32_t size() const { return len; }
+
+private:
+    MappedFile(const MappedFile &); // disallow
+    MappedFile &operator=(const MappedFile &); // disallow
+
+    const char *text;
+    uint32_t len;
+};
 
 class Reader {
     Context *ctx;
-    Module *module;
+    LineIndex *lines;
 
     const char *text;
+    uint32_t len;
     uint32_t pos;
-    SourceLoc loc;
+    uint32_t base; // offset of text in the module's source (see LineIndex)
 
-    static const uint32_t SCRATCH_LEN = 1024;
-    char scratch[SCRATCH_LEN];
+    // read_form recurses for nested lists, quotes and type ascriptions, so its
+    // depth is bounded to fail with an error rather than by running out of stack
+    static const uint32_t MAX_DEPTH = 5000;
+    uint32_t depth;
 
 public:
-    Reader(Context *ctx) : ctx(ctx), module(ctx->module) {
+    Reader(Context *ctx) : ctx(ctx), lines(&ctx->module->lines) {
     }
 
     Any *read_file(const char *text) {
+        return read_file(text, (uint32_t)strlen(text));
+    }
+
+    // text does not need to be NUL-terminated; end of input is detected by len
+    Any *read_file(const char *text, uint32_t len) {
+        uint32_t base = lines->size();
+        lines->add(text, len);
+        return read_file(text, len, base);
+    }
+
+    // read a piece of source text which has already been added to the line index
+    // at the given offset (used to read a file piecewise)
+    Any *read_file(const char *text, uint32_t len, uint32_t base) {
         this->text = text;
+        this->len = len;
+        this->base = base;
         pos = 0;
-        loc.line = 0;
-        loc.col = 0;
+        depth = 0;
+        if (ctx->diagnostics) {
+            return read_forms_recovering();
+        }
         return read_list('\0');
     }
 
+    // read directly from a read-only mapping of the file, without copying it
+    Any *read_path(const char *path) {
+        // everything the reader keeps is copied into the arena, so the mapping can go after
+        MappedFile file(path);
+        return read_file(file.data(), file.size());
+    }
+
     Any *read_form() {
+        if (++depth > MAX_DEPTH) {
+            read_error("forms are nested too deeply");
+        }
         Any *result = NULL;
         skip_space();
         char ch = peek();
@@ -51,15 +135,16 @@ public:
         } else if (ch == '\'') {
             step();
             Any *form = read_form();
-            result = list(ctx, symbol(ctx, "quote"), form);
+            result = list(ctx, &SYM_QUOTE, form);
         } else if (ch == '"') {
             step();
             result = read_string();
-        } else if (is_alpha(ch) || is_symchar(ch)) {
-            result = read_symbol();
         } else if (is_digit(ch) || ((ch == '+' || ch == '-') && is_digit(peek(1)))) {
+            // checked before symbols, which may also start with + or -
             result = read_number();
             expect_delim();
+        } else if (is_symstart(ch)) {
+            result = read_symbol();
         } else {
             read_error("expected an expression");
         }
@@ -70,7 +155,7 @@ public:
                 step();
                 skip_space();
                 Any *sym = read_symbol();
-                result = list(ctx, symbol(ctx, "prop"), sym, result);
+                result = list(ctx, &SYM_PROP, sym, result);
             } else if (ch == '[') {
                 step();
                 Any *list = read_list(']');
@@ -82,296 +167,396 @@ public:
         if (ch == ':') {
             step();
             Any *typeform = read_form();
-            result = list(ctx, symbol(ctx, "ascribe"), result, typeform);
+            result = list(ctx, &SYM_ASCRIBE, result, typeform);
         }
+        --depth;
         return result;
     }
 
-    Any *read_list(char end) {
-        skip_space();
-        if (peek() == end) {
-            step();
-            return &NIL;
+    // like read_list('\0'), but a top-level form with an error is recorded in
+    // ctx->diagnostics and dropped, and reading goes on with the next one
+    Any *read_forms_recovering() {
+        Any *result = &NIL;
+        Box<Cons> *tail = NULL;
+        while (true) {
+            skip_space();
+            if (peek() == '\0') {
+                return result;
+            }
+
+            uint32_t form_offset = base + pos;
+            Any *form;
+            if (!read_toplevel_form(form)) {
+                continue;
+            }
+            Box<Cons> *next = located_cons(ctx, form, &NIL, form_offset);
+            if (tail) {
+                tail->value.cdr = next;
+            } else {
+                result = next;
+            }
+            tail = next;
         }
+    }
 
-        SourceLoc orig_loc(loc);
-        Any *form = read_form();
-        Any *result = cons(ctx, form, read_list(end));
-        // store location of all car forms, using the containing cons as key
-        module->locations.put(result, orig_loc); 
-        return result;
+    // Reads the top-level form at pos. On an error, everything allocated for the form
+    // is freed, pos is moved to the start of the next top-level form and false is
+    // returned.
+    bool read_toplevel_form(Any *&form_out) {
+        Diagnostics *diagnostics = ctx->diagnostics;
+        jmp_buf *outer = diagnostics->recovery;
+        Arena::Mark mark = ctx->arena->mark();
+        uint32_t start = pos;
+
+        jmp_buf recovery;
+        if (setjmp(recovery)) {
+            diagnostics->recovery = outer;
+            ctx->arena->rollback(mark);
+            depth = 0;
+            // resynchronise where a FormScanner sees the form end, which is
+            // always past start
+            FormScanner scanner;
+            pos = start;
+            scanner.scan(text, pos, len);
+            return false;
+        }
+        diagnostics->recovery = &recovery;
+        form_out = read_form();
+        diagnostics->recovery = outer;
+        return true;
+    }
+
+    Any *read_list(char end) {
+        Any *result = &NIL;
+        Box<Cons> *tail = NULL;
+        while (true) {
+            skip_space();
+            if (peek() == end) {
+                if (end != '\0') {
+                    step();
+                }
+                return result;
+            }
+
+            uint32_t form_offset = base + pos;
+            Any *form = read_form();
+            // store location of all car forms with the containing cons
+            Box<Cons> *next = located_cons(ctx, form, &NIL, form_offset);
+            if (tail) {
+                tail->value.cdr = next;
+            } else {
+                result = next;
+            }
+            tail = next;
+        }
     }
 
     Any *read_string() {
-        uint32_t len = 0;
+        StringBuilder builder(ctx->arena);
         while (true) {
+            // copy runs of plain characters in one go
+            uint32_t start = pos;
+            while (pos < len) {
+                char ch = text[pos];
+                if (ch == '"' || ch == '\\' || ch == '\r' || ch == '\n') {
+                    break;
+                }
+                ++pos;
+            }
+            builder.append(text + start, pos - start);
+
+            if (pos >= len) {
+                read_error("unexpected end of input while reading string");
+            }
             char ch = peek();
             if (ch == '"') {
                 step();
-                if (len >= SCRATCH_LEN) {
-                    read_error("string is too long");
-                }
-                scratch[len] = '\0';
-                return string(ctx, scratch);
+                return string(ctx, builder);
             } else if (ch == '\\') {
                 step();
-                ch = peek();
-                if (ch == '\0') {
+                if (pos >= len) {
                     read_error("unexpected end of input while reading string");
                 }
-                if (len >= SCRATCH_LEN) {
-                    read_error("string is too long");
-                }
+                ch = peek();
                 switch (ch) {
-                case '\'': scratch[len++] = '\''; break;
-                case '"': scratch[len++] = '"'; break;
-                case '?': scratch[len++] = '?'; break;
-                case '\\': scratch[len++] = '\\'; break;
-                case 'a': scratch[len++] = '\a'; break;
-                case 'b': scratch[len++] = '\b'; break;
-                case 'f': scratch[len++] = '\f'; break;
-                case 'n': scratch[len++] = '\r'; break;
-                case 'r': scratch[len++] = '\r'; break;
-                case 't': scratch[len++] = '\t'; break;
-                case 'v': scratch[len++] = '\v'; break;
+                case '\'': builder.push('\''); break;
+                case '"': builder.push('"'); break;
+                case '?': builder.push('?'); break;
+                case '\\': builder.push('\\'); break;
+                case 'a': builder.push('\a'); break;
+                case 'b': builder.push('\b'); break;
+                case 'f': builder.push('\f'); break;
+                case 'n': builder.push('\n'); break;
+                case 'r': builder.push('\r'); break;
+                case 't': builder.push('\t'); break;
+                case 'v': builder.push('\v'); break;
                 // TODO: handle \nnn \xnn \unnnn \Unnnnnnnn
                 default: read_error("unexpected escape char: %c", ch);
                 }
                 step();
-            } else if (ch == '\0') {
-                read_error("unexpected end of input while reading string");
             } else {
-                if (ch == '\r' || ch == '\n') {
-                    spacestep();
-                } else {
-                    step();
-                }
-                if (len >= SCRATCH_LEN) {
-                    read_error("string is too long");
-                }
-                scratch[len++] = ch;
+                step(); // '\r' or '\n'
+                builder.push(ch);
             }
         }
         return NULL;
     }
 
     Any *read_symbol() {
-        uint32_t len = 0;
-        while (true) {
-            char ch = peek();
-            if (!is_alphanum(ch) && !is_symchar(ch)) {
-                if (len == 0) {
-                    read_error("expected a symbol");
-                }
-                if (len >= SCRATCH_LEN) {
-                    read_error("string is too long");
-                }
-                scratch[len] = '\0';
-                return symbol(ctx, scratch);
-            }
-            if (len >= SCRATCH_LEN) {
-                read_error("string is too long");
-            }
-            scratch[len++] = ch;
-            step();
+        uint32_t start = pos;
+        while (pos < len && char_is(text[pos], CHAR_SYMCONT)) {
+            ++pos;
+        }
+        if (pos == start) {
+            read_error("expected a symbol");
         }
+        // intern straight from the source text
+        return symbol(ctx, text + start, pos - start);
     }
 
     Any *read_number() {
-        errno = 0;
-        const char *end;
-        const char *start = text + pos;
-        // TODO: handle unsigned numbers
-        i64 llval = my_strtoll(start, &end, 0);
-        if (start == end) {
+        uint32_t start = pos;
+        bool negative = false;
+        if (peek() == '+' || peek() == '-') {
+            negative = peek() == '-';
+            ++pos;
+        }
+        uint64_t magnitude;
+        bool overflow;
+        uint32_t num_len = parse_uint(text + pos, len - pos, magnitude, overflow);
+        if (num_len == 0) {
             read_error("error parsing number");
         }
-        if (errno == ERANGE) {
+        // a float is decimal even with a leading 0, as in C: 0123.5 is 123.5
+        uint32_t digits = 0;
+        while (char_is(peek(digits), CHAR_DIGIT)) {
+            ++digits;
+        }
+        char after = peek(digits);
+        if (digits >= num_len && (after == '.' || after == 'e' || after == 'E')) {
+            pos = start;
+            return read_float();
+        }
+        if (overflow) {
             read_error("number too large");
         }
-        if (*end != '.') {
-            pos += (int)(end - start);
-            char ch = peek();
-            if (ch == 'i') {
-                step();
-                ch = peek();
-                if (ch == '8') {
-                    step();
-                    // TODO: check that these numbers fit
-                    return box(ctx, (i8)llval);
-                }
-                if (ch == '1' && peek(1) == '6') {
-                    step();
-                    step();
-                    return box(ctx, (i16)llval);
-                }
-                if (ch == '6' && peek(1) == '4') {
-                    step();
-                    step();
-                    return box(ctx, (i64)llval);
-                }
-                if (ch == '3' && peek(1) == '2') {
-                    step();
-                    step();
-                    // leave if block, and go to default for 'i' suffix which is i32
-                }
-                return box(ctx, (i32)llval);
-            } else if (ch == 'u') {
-                step();
-                ch = peek();
-                if (ch == '8') {
-                    step();
-                    return box(ctx, (u8)llval);
-                }
-                if (ch == '1' && peek(1) == '6') {
-                    step();
-                    step();
-                    return box(ctx, (u16)llval);
-                }
-                if (ch == '6' && peek(1) == '4') {
-                    step();
-                    step();
-                    return box(ctx, (u64)llval);
-                }
-                if (ch == '3' && peek(1) == '2') {
-                    step();
-                    step();
-                    // leave if block, and go to default for 'u' suffix which is u32
-                }
-                return box(ctx, (u32)llval);
+        pos += num_len;
+
+        char ch = peek();
+        if (ch == 'i') {
+            step();
+            int bits = read_int_suffix_bits();
+            uint64_t max = (((uint64_t)1 << (bits - 1)) - 1) + (negative ? 1 : 0);
+            if (magnitude > max) {
+                pos = start;
+                read_error("number does not fit in i%d", bits);
+            }
+            i64 value = negative ? (i64)(0 - magnitude) : (i64)magnitude;
+            switch (bits) {
+            case 8: return box(ctx, (i8)value);
+            case 16: return box(ctx, (i16)value);
+            case 64: return box(ctx, value);
+            default: return box(ctx, (i32)value);
+            }
+        } else if (ch == 'u') {
+            step();
+            int bits = read_int_suffix_bits();
+            uint64_t max = bits == 64 ? UINT64_MAX : ((uint64_t)1 << bits) - 1;
+            if (magnitude > max || (negative && magnitude != 0)) {
+                pos = start;
+                read_error("number does not fit in u%d", bits);
+            }
+            switch (bits) {
+            case 8: return box(ctx, (u8)magnitude);
+            case 16: return box(ctx, (u16)magnitude);
+            case 64: return box(ctx, (u64)magnitude);
+            default: return box(ctx, (u32)magnitude);
             }
-            return box(ctx, (i64)llval);
-        }
-        start = text + pos;
-        f64 dval = my_strtod(start, &end);
-        if (start == end) {
-            read_error("error parsing number");
         }
-        if (errno == ERANGE) {
-            read_error("number too large");
+        if (magnitude > (uint64_t)INT64_MAX + (negative ? 1 : 0)) {
+            pos = start;
+            read_error("number does not fit in i64");
         }
-        pos += (int)(end - start);
+        return box(ctx, negative ? (i64)(0 - magnitude) : (i64)magnitude);
+    }
+
+    // reads the width after an i or u suffix, which defaults to 32
+    int read_int_suffix_bits() {
         char ch = peek();
-        if (ch == 'f') {
+        if (ch == '8') {
             step();
-            ch = peek();
-            if (ch == '6' && peek(1) == '4') {
+            return 8;
+        }
+        if (ch == '1' && peek(1) == '6') {
+            step();
+            step();
+            return 16;
+        }
+        if (ch == '6' && peek(1) == '4') {
+            step();
+            step();
+            return 64;
+        }
+        if (ch == '3' && peek(1) == '2') {
+            step();
+            step();
+        }
+        return 32;
+    }
+
+    Any *read_float() {
+        DecimalFloat decimal;
+        uint32_t num_len = parse_decimal_float(text + pos, len - pos, decimal);
+        if (num_len == 0) {
+            read_error("error parsing number");
+        }
+        const char *num_text = text + pos;
+        uint32_t start = pos;
+        pos += num_len;
+
+        // parse straight to the suffix type, rather than rounding twice through f64
+        bool single = false;
+        if (peek() == 'f') {
+            step();
+            if (peek() == '6' && peek(1) == '4') {
                 step();
                 step();
-                return box(ctx, (f32)dval);
+            } else {
+                if (peek() == '3' && peek(1) == '2') {
+                    step();
+                    step();
+                }
+                single = true;
             }
-            if (ch == '3' && peek(1) == '2') {
-                step();
-                step();
-                // leave if block, and go to default for 'f' suffix which is f32
+        }
+        if (single) {
+            f32 value = decimal_to_float<Binary32Format>(decimal, num_text, num_len);
+            if (value - value != 0) {
+                pos = start;
+                read_error("number too large");
             }
-            return box(ctx, (f32)dval);
+            return box(ctx, value);
+        }
+        f64 value = decimal_to_float<Binary64Format>(decimal, num_text, num_len);
+        if (value - value != 0) {
+            pos = start;
+            read_error("number too large");
         }
-        return box(ctx, dval);
+        return box(ctx, value);
     }
 
     inline char peek(int offset = 0) {
-        return text[pos + offset];
+        uint32_t i = pos + offset;
+        return i < len ? text[i] : '\0';
     }
 
     inline void step() {
-        ++loc.col;
         ++pos;
     }
 
-    inline void spacestep() {
-        if (text[pos] == '\r') {
-            if (text[pos + 1] != '\n') {
-                ++loc.line;
-                loc.col = 0;
-                ++pos;
+    void skip_space() {
+        while (true) {
+            char ch = peek();
+            if (char_is(ch, CHAR_BLANK)) {
+                pos = scan_blanks(pos);
+            } else if (char_is(ch, CHAR_SPACE)) {
+                step();
+            } else if (ch == ';') { // line comment
+                pos = scan_line_end(pos);
+            } else {
                 return;
             }
-        } else if (text[pos] == '\n') {
-            ++loc.line;
-            loc.col = 0;
-            ++pos;
-            return;
         }
-        ++loc.col;
-        ++pos;
     }
 
-    void skip_space() {
-        char ch;
-        while (true) {
-            switch (peek()) {
-            case ' ':
-            case '\t':
-            case '\f':
-            case '\v':
-            case '\r':
-            case '\n':
-                spacestep();
-                continue;
-            case ';': // line comment
-                do {
-                    spacestep();
-                    ch = peek();
-                } while (ch && ch != '\n' && ch != '\r');
-                continue;
-            default:
-                return;
+    // index of the first char at or after i that is not ' ', '\t', '\f' or '\v'
+    uint32_t scan_blanks(uint32_t i) {
+#if defined(__AVX2__)
+        const __m256i sp = _mm256_set1_epi8(' ');
+        const __m256i ht = _mm256_set1_epi8('\t');
+        const __m256i vt = _mm256_set1_epi8('\v');
+        const __m256i ff = _mm256_set1_epi8('\f');
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(text + i));
+            __m256i m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, ht)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, vt), _mm256_cmpeq_epi8(v, ff)));
+            uint32_t other = ~(uint32_t)_mm256_movemask_epi8(m);
+            if (other) {
+                return i + __builtin_ctz(other);
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i sp16 = _mm_set1_epi8(' ');
+        const __m128i ht16 = _mm_set1_epi8('\t');
+        const __m128i vt16 = _mm_set1_epi8('\v');
+        const __m128i ff16 = _mm_set1_epi8('\f');
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+            __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, sp16), _mm_cmpeq_epi8(v, ht16)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, vt16), _mm_cmpeq_epi8(v, ff16)));
+            uint32_t other = ~(uint32_t)_mm_movemask_epi8(m) & 0xffff;
+            if (other) {
+                return i + __builtin_ctz(other);
             }
         }
+#endif
+        while (i < len && char_is(text[i], CHAR_BLANK)) {
+            ++i;
+        }
+        return i;
     }
 
-    inline bool is_alpha(char ch) { return is_upper(ch) || is_lower(ch); }
-    inline bool is_upper(char ch) { return ch >= 'A' && ch <= 'Z'; }
-    inline bool is_lower(char ch) { return ch >= 'a' && ch <= 'z'; }
-    inline bool is_digit(char ch) { return ch >= '0' && ch <= '9'; }
-    inline bool is_alphanum(char ch) { return is_alpha(ch) || is_digit(ch); }
-    inline bool is_symchar(char ch) {
-        switch (ch) {
-        case '_':
-        case '-':
-        case '=':
-        case '+':
-        case '*':
-        case '/':
-        case '?':
-        case '!':
-        case '&':
-        case '%':
-        case '^':
-        case '~':
-            return true;
-        default:
-            return false;
+    // index of the first '\n' or '\r' at or after i (or len if there is none)
+    uint32_t scan_line_end(uint32_t i) {
+#if defined(__AVX2__)
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const __m256i cr = _mm256_set1_epi8('\r');
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(text + i));
+            __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr));
+            uint32_t eol = (uint32_t)_mm256_movemask_epi8(m);
+            if (eol) {
+                return i + __builtin_ctz(eol);
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i lf16 = _mm_set1_epi8('\n');
+        const __m128i cr16 = _mm_set1_epi8('\r');
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+            __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, lf16), _mm_cmpeq_epi8(v, cr16));
+            uint32_t eol = (uint32_t)_mm_movemask_epi8(m);
+            if (eol) {
+                return i + __builtin_ctz(eol);
+            }
         }
+#endif
+        for (; i < len; ++i) {
+            char ch = text[i];
+            if (ch == '\n' || ch == '\r') {
+                break;
+            }
+        }
+        return i;
     }
 
+    inline bool is_symstart(char ch) { return char_is(ch, CHAR_SYMSTART); }
+    inline bool is_digit(char ch) { return char_is(ch, CHAR_DIGIT); }
+
     void expect_delim() {
-        switch (peek()) {
-        case ' ':
-        case '\t':
-        case '\f':
-        case '\v':
-        case '\r':
-        case '\n':
-        case '.':
-        case ':':
-        case '(':
-        case ')':
-        case '[':
-        case ']':
-            return;
+        if (!char_is(peek(), CHAR_DELIM)) {
+            read_error("expected delimiter after expression");
         }
-        read_error("expected delimiter after expression");
     }
 
     void read_error(const char *fmt, ...) {
-        printf("line %d, col %d: ", loc.line + 1, loc.col + 1);
         va_list args;
         va_start(args, fmt);
-        vprintf(fmt, args);
+        source_error(ctx, true, base + pos, fmt, args);
         va_end(args);
-        printf("\n");
-        exit(1);
     }
 };
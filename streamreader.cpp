@@ -0,0 +1,126 @@
+
+// Reads top-level forms from input that arrives in chunks (e.g. from a pipe),
+// handing each form to a callback as soon as it is complete.
+//
+// Incoming bytes are appended to a buffer which is scanned incrementally for the
+// end of the current top-level form (see FormScanner), so tokens can straddle chunk
+// boundaries. Each complete form is then read with a normal Reader and dropped from
+// the buffer, so the buffer only ever needs to hold about one form.
+
+// offset is the location of form in the module's source text (see LineIndex)
+typedef void (*FormCallback)(void *userdata, Any *form, uint32_t offset);
+
+class StreamReader {
+public:
+    StreamReader(Context *ctx, FormCallback callback, void *userdata)
+    : module(ctx->module), reader(ctx), callback(callback), userdata(userdata),
+      offset(ctx->module->lines.size()),
+      buffer(NULL), start(0), used(0), capacity(0), scan_pos(0) {}
+
+    ~StreamReader() {
+        free(buffer);
+    }
+
+    void feed(const char *data, uint32_t len) {
+        reserve(len);
+        memcpy(buffer + used, data, len);
+        module->lines.add(data, len);
+        used += len;
+        scan();
+    }
+
+    // signal end of input, reading whatever is left in the buffer
+    void finish() {
+        scan();
+        emit(used);
+        start = 0;
+        used = 0;
+        scan_pos = 0;
+        scanner.reset();
+    }
+
+    // feed everything that can be read from fd, then finish
+    void read_fd(int fd) {
+        const uint32_t chunk_size = 65536;
+        while (true) {
+            reserve(chunk_size);
+            ssize_t n = read(fd, buffer + used, chunk_size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fatal_error("error reading input: %s", strerror(errno));
+            }
+            if (n == 0) {
+                break;
+            }
+            module->lines.add(buffer + used, (uint32_t)n);
+            used += (uint32_t)n;
+            scan();
+        }
+        finish();
+    }
+
+private:
+    StreamReader(const StreamReader &); // disallow
+    StreamReader &operator=(const StreamReader &); // disallow
+
+    Module *module;
+    Reader reader;
+    FormCallback callback;
+    void *userdata;
+    uint32_t offset; // source offset of buffer + start
+
+    char *buffer;
+    uint32_t start; // start of the unread part of buffer
+    uint32_t used;
+    uint32_t capacity;
+    uint32_t scan_pos;
+
+    FormScanner scanner;
+
+    void scan() {
+        while (scanner.scan(buffer, scan_pos, used)) {
+            emit(scan_pos);
+        }
+    }
+
+    // read the forms in buffer[start..end) and drop them from the buffer
+    void emit(uint32_t end) {
+        Any *list = reader.read_file(buffer + start, end - start, offset);
+        offset += end - start;
+        while (!nilp(list)) {
+            Ptr<Cons> cell(list);
+            uint32_t form_offset = 0;
+            source_offset(list, form_offset);
+            callback(userdata, cell->car, form_offset);
+            list = cell->cdr;
+        }
+
+        start = end;
+    }
+
+    // make room for at least extra more bytes after used
+    void reserve(uint32_t extra) {
+        if (start > 0) {
+            // drop what has already been read
+            memmove(buffer, buffer + start, used - start);
+            used -= start;
+            scan_pos -= start;
+            start = 0;
+        }
+        uint32_t needed = used + extra;
+        if (needed <= capacity) {
+            return;
+        }
+        uint32_t new_capacity = capacity ? capacity : 4096;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        buffer = (char *)realloc(buffer, new_capacity);
+        if (!buffer) {
+            fatal_error("out of memory");
+        }
+        capacity = new_capacity;
+    }
+};
@@ -0,0 +1,240 @@
+
+// An open addressing hash table in the style of Abseil's "Swiss tables", for now
+// only used by bench_hash_tables to compare against HashTable. It has HashTable's
+// get, put, remove, reserve, get_hashed, put_hashed and Iterator, but no lookup,
+// emplace, put_all, incremental resize, shrinking or stats.
+//
+// Keys and values have to be trivially copyable (pointers, numbers, StringRef):
+// slots are calloc'd and filled by assignment, and no constructors or destructors
+// are run, unlike in HashTable.
+//
+// Next to the entries is an array of one control byte per slot: EMPTY, DELETED,
+// or the low 7 bits of the hash of the key stored there. Slots are probed in
+// groups of 16, and one SSE2 compare finds the slots in a group whose control byte
+// matches, so keys are only compared for (almost certain) hash matches. The rest
+// of the hash picks the first group; further groups follow a triangular sequence.
+//
+// https://abseil.io/about/design/swisstables
+
+template<
+    typename TKey,
+    typename TValue,
+    typename THashFunc = Hash<TKey>,
+    typename TEqualFunc = Equal<TKey>
+>
+class SwissTable {
+    struct Entry {
+        TKey key;
+        TValue value;
+    };
+
+    static const uint32_t GROUP_SIZE = 16;
+    static const int8_t EMPTY = -128;
+    static const int8_t DELETED = -2;
+
+    uint32_t used;
+    uint32_t deleted;
+    uint32_t size; // number of slots, a power of 2 and a multiple of GROUP_SIZE
+    int8_t *ctrl;
+    Entry *entries;
+
+    SwissTable(const SwissTable &); // disallow
+    SwissTable &operator=(const SwissTable &); // disallow
+
+public:
+    // visits the occupied slots in table order
+    class Iterator {
+    public:
+        Iterator(const SwissTable &table) : table(table), index(0) {
+            skip_empty();
+        }
+
+        bool valid() const { return index < table.size; }
+        void next() { ++index; skip_empty(); }
+        const TKey &key() const { return table.entries[index].key; }
+        TValue &value() const { return table.entries[index].value; }
+
+    private:
+        const SwissTable &table;
+        uint32_t index;
+
+        void skip_empty() {
+            while (index < table.size && table.ctrl[index] < 0) {
+                ++index;
+            }
+        }
+    };
+    friend class Iterator;
+
+    SwissTable(uint32_t size = 16) : used(0), deleted(0), size(0), ctrl(NULL), entries(NULL) {
+        uint32_t slots = GROUP_SIZE;
+        while (slots < size) {
+            slots *= 2;
+        }
+        resize(slots);
+    }
+
+    ~SwissTable() {
+        free(ctrl);
+        free(entries);
+    }
+
+    // make room for n entries, so that putting them does not resize the table
+    void reserve(uint32_t n) {
+        uint32_t slots = size;
+        while (slots - slots / 8 < n) {
+            slots *= 2;
+        }
+        if (slots > size) {
+            resize(slots);
+        }
+    }
+
+    bool get(TKey key, TValue &value_out) {
+        return get_hashed(calc_hash(key), key, value_out);
+    }
+
+    void put(TKey key, TValue value) {
+        put_hashed(calc_hash(key), key, value);
+    }
+
+    // variants taking the hash of the key and accepting other key types, as in
+    // HashTable
+    template<typename TProbe>
+    bool get_hashed(uint32_t hash, const TProbe &key, TValue &value_out) {
+        uint32_t index;
+        if (find(key, hash, index)) {
+            value_out = entries[index].value;
+            return true;
+        }
+        return false;
+    }
+
+    void put_hashed(uint32_t hash, TKey key, TValue value) {
+        uint32_t index;
+        if (find(key, hash, index)) {
+            entries[index].value = value;
+            return;
+        }
+        if (used + deleted >= size - size / 8) {
+            // grow, or just clear out the tombstones if they take most of the room
+            resize(used >= size / 2 ? size * 2 : size);
+        }
+        insert(hash, key, value);
+    }
+
+    bool remove(TKey key) {
+        uint32_t index;
+        if (!find(key, calc_hash(key), index)) {
+            return false;
+        }
+        // probes go on past a group only if it is full, so if this group has an
+        // empty slot no probe can need to pass this slot either
+        uint32_t group = index & ~(GROUP_SIZE - 1);
+        if (match(ctrl + group, EMPTY)) {
+            ctrl[index] = EMPTY;
+        } else {
+            ctrl[index] = DELETED;
+            ++deleted;
+        }
+        --used;
+        return true;
+    }
+
+private:
+    template<typename TProbe>
+    bool find(const TProbe &key, uint32_t hash, uint32_t &index_out) const {
+        int8_t h2 = (int8_t)(hash & 0x7F);
+        uint32_t mask = size - 1;
+        uint32_t group = (hash >> 7) * GROUP_SIZE & mask;
+        for (uint32_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+            uint32_t candidates = match(ctrl + group, h2);
+            while (candidates) {
+                uint32_t index = group + __builtin_ctz(candidates);
+                if (TEqualFunc()(entries[index].key, key)) {
+                    index_out = index;
+                    return true;
+                }
+                candidates &= candidates - 1;
+            }
+            if (match(ctrl + group, EMPTY)) {
+                return false;
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    // key must not be in the table already, and there must be a free slot
+    void insert(uint32_t hash, TKey key, TValue value) {
+        uint32_t mask = size - 1;
+        uint32_t group = (hash >> 7) * GROUP_SIZE & mask;
+        for (uint32_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+            uint32_t free_slots = match_free(ctrl + group);
+            if (free_slots) {
+                uint32_t index = group + __builtin_ctz(free_slots);
+                if (ctrl[index] == DELETED) {
+                    --deleted;
+                }
+                ctrl[index] = (int8_t)(hash & 0x7F);
+                entries[index].key = key;
+                entries[index].value = value;
+                ++used;
+                return;
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    void resize(uint32_t new_size) {
+        uint32_t old_size = size;
+        int8_t *old_ctrl = ctrl;
+        Entry *old_entries = entries;
+
+        used = 0;
+        deleted = 0;
+        size = new_size;
+        ctrl = (int8_t *)malloc(new_size);
+        memset(ctrl, EMPTY, new_size);
+        entries = (Entry *)calloc(1, sizeof(Entry) * new_size);
+
+        for (uint32_t i = 0; i < old_size; ++i) {
+            if (old_ctrl[i] >= 0) {
+                Entry &slot = old_entries[i];
+                insert(calc_hash(slot.key), slot.key, slot.value);
+            }
+        }
+        free(old_ctrl);
+        free(old_entries);
+    }
+
+    // bit i set if group[i] == value
+    static uint32_t match(const int8_t *group, int8_t value) {
+#if defined(__SSE2__)
+        __m128i g = _mm_loadu_si128((const __m128i *)group);
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(value)));
+#else
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < GROUP_SIZE; ++i) {
+            result |= (uint32_t)(group[i] == value) << i;
+        }
+        return result;
+#endif
+    }
+
+    // bit i set if group[i] is EMPTY or DELETED (the only negative control bytes)
+    static uint32_t match_free(const int8_t *group) {
+#if defined(__SSE2__)
+        return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+        uint32_t result = 0;
+        for (uint32_t i = 0; i < GROUP_SIZE; ++i) {
+            result |= (uint32_t)(group[i] < 0) << i;
+        }
+        return result;
+#endif
+    }
+
+    uint32_t calc_hash(TKey key) const {
+        return THashFunc()(key);
+    }
+};
@@ -58,8 +58,9 @@ struct Unknown { };
 
 struct Symbol {
     int length;
+    int id; // a KW_ constant for keywords, KW_NONE otherwise
     char *data;
-    Symbol(int length, char *data) : length(length), data(data) {}
+    Symbol(int length, char *data, int id = 0) : length(length), id(id), data(data) {}
 };
 
 struct String {
@@ -67,6 +68,7 @@ struct String {
     int capacity;
     char *data;
     String(int length, char *data) : length(length), capacity(length), data(data) {}
+    String(int length, int capacity, char *data) : length(length), capacity(capacity), data(data) {}
 };
 
 struct Cons {
@@ -116,12 +118,46 @@ DEF_TYPE(Symbol, TYPE_SYMBOL);
 DEF_TYPE(String, TYPE_STRING);
 DEF_TYPE(Cons, TYPE_CONS);
 
+// conses that carry a source location (see located_cons), told apart from
+// other conses by their Type object only
+Box<Type> type_LocatedCons(&type_Type.value, Type(TYPE_CONS, sizeof(Cons)));
+
 
 Box<Cons> NIL(&type_Cons.value, Cons(NULL, NULL));
 Box<bool> TRUE(&type_bool.value, true);
 Box<bool> FALSE(&type_bool.value, false);
 
 
+// Symbols with a meaning to the reader or parser. They are shared by all contexts,
+// whose symbol tables start out with them (see Context), so they can be used
+// without a lookup and dispatched on by id.
+#define KEYWORDS(X) \
+    X(DEF, "def") \
+    X(QUOTE, "quote") \
+    X(PROP, "prop") \
+    X(ASCRIBE, "ascribe")
+
+enum {
+    KW_NONE,
+#define X(NAME, TEXT) KW_##NAME,
+    KEYWORDS(X)
+#undef X
+    NUM_KEYWORDS
+};
+
+#define X(NAME, TEXT) \
+Box<Symbol> SYM_##NAME(&type_Symbol.value, Symbol(sizeof(TEXT) - 1, (char *)TEXT, KW_##NAME));
+KEYWORDS(X)
+#undef X
+
+Box<Symbol> *KEYWORD_SYMBOLS[NUM_KEYWORDS] = {
+    NULL,
+#define X(NAME, TEXT) &SYM_##NAME,
+    KEYWORDS(X)
+#undef X
+};
+
+
 template<typename T>
 class Ptr {
     Box<T> *box;
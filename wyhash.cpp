@@ -0,0 +1,112 @@
+
+// wyhash, by Wang Yi, released into the public domain (The Unlicense).
+// https://github.com/wangyi-fudan/wyhash
+//
+// A 64-bit hash built on one 64x64->128 bit multiply per 16 bytes of input, which
+// makes it several times faster than MurmurHash3_x86_32 on x86-64, most of all
+// for short keys such as symbol names. The steps of wyhash() follow the "final 4"
+// release of wyhash.h (without the optional condom mode), but the secret is the
+// default _wyp of the older "final 3" release, so the hashes differ from those of
+// upstream's final 4.
+
+static const uint64_t WYHASH_SECRET[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+// the 128-bit product of *a and *b, low half in *a and high half in *b
+static inline void wyhash_mum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wyhash_mix(uint64_t a, uint64_t b) {
+    wyhash_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wyhash_read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wyhash_read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// 1 to 3 bytes
+static inline uint64_t wyhash_read3(const uint8_t *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+// The first step of wyhash() depends only on the seed, so that hashing many keys
+// with one seed can do it once: wyhash(key, len, seed) is
+// wyhash_seeded(key, len, wyhash_seed(seed)).
+static inline uint64_t wyhash_seed(uint64_t seed) {
+    return seed ^ wyhash_mix(seed ^ WYHASH_SECRET[0], WYHASH_SECRET[1]);
+}
+
+static inline uint64_t wyhash_seeded(const void *key, size_t len, uint64_t seed) {
+    const uint64_t *secret = WYHASH_SECRET;
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t a, b;
+    if (__builtin_expect(len <= 16, 1)) {
+        if (len >= 4) {
+            a = (wyhash_read4(p) << 32) | wyhash_read4(p + ((len >> 3) << 2));
+            b = (wyhash_read4(p + len - 4) << 32) | wyhash_read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyhash_read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wyhash_mix(wyhash_read8(p) ^ secret[1], wyhash_read8(p + 8) ^ seed);
+                see1 = wyhash_mix(wyhash_read8(p + 16) ^ secret[2], wyhash_read8(p + 24) ^ see1);
+                see2 = wyhash_mix(wyhash_read8(p + 32) ^ secret[3], wyhash_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wyhash_mix(wyhash_read8(p) ^ secret[1], wyhash_read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyhash_read8(p + i - 16);
+        b = wyhash_read8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    wyhash_mum(&a, &b);
+    return wyhash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+uint64_t wyhash(const void *key, size_t len, uint64_t seed) {
+    return wyhash_seeded(key, len, wyhash_seed(seed));
+}
+
+// A local mixer for 64-bit integers built from wyhash_mix, not upstream's
+// two-argument wyhash64: every bit of v affects every bit of the result.
+static inline uint64_t wyhash64(uint64_t v) {
+    return wyhash_mix(v ^ WYHASH_SECRET[0], WYHASH_SECRET[1]);
+}